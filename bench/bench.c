@@ -0,0 +1,328 @@
+#include "bench.h"
+#include "memory.h"
+#include "wstr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+/**
+ * Path components the generator draws from.
+ */
+static wchar_t const* const VENDORS[] = {
+	L"microsoft", L"mozilla", L"google", L"adobe", L"jetbrains", L"valve",
+	L"nvidia corporation", L"common files", L"windowsapps", L"git"
+};
+
+static wchar_t const* const PRODUCTS[] = {
+	L"edge", L"firefox", L"chrome", L"acrobat reader dc", L"intellij idea community edition",
+	L"steam", L"geforce experience", L"microsoft shared", L"visual studio", L"mingw64"
+};
+
+static wchar_t const* const FOLDERS[] = {
+	L"bin", L"application", L"x64", L"resources", L"updater", L"libexec", L"tools", L"plugins"
+};
+
+static wchar_t const* const NAMES[] = {
+	L"svchost", L"update", L"helper", L"crashpad_handler", L"setup", L"launcher",
+	L"service", L"telemetry", L"node", L"python"
+};
+
+/**
+ * The device every generated path lives on, less the volume number.
+ */
+static wchar_t const DEVICE_PREFIX[] = L"\\device\\harddiskvolume";
+
+/**
+ * The short name of c:\program files known to the fake resolver.
+ */
+#define SHORT_PROGRAM_FILES L"c:\\progra~1"
+
+static struct {
+	bool open;
+} g;
+
+char const* bench_dist_name(enum BENCH_DIST dist) {
+	switch (dist) {
+		case BENCH_DIST_SHORT: return "short";
+		case BENCH_DIST_MIXED: return "mixed";
+		case BENCH_DIST_DEEP: return "deep";
+		default: return "unknown";
+	}
+}
+
+uint64_t bench_rand(uint64_t* state) {
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+#define PICK(rng, list) (list[bench_rand(rng) % (sizeof(list) / sizeof(list[0]))])
+
+static void make_short(wchar_t* dest, size_t count, size_t index, uint64_t* rng) {
+	swprintf(dest, count, L"c:\\windows\\system32\\%ls%zu.exe", PICK(rng, NAMES), index);
+}
+
+static void make_deep(wchar_t* dest, size_t count, size_t index, uint64_t* rng) {
+	swprintf(dest, count, L"c:\\program files\\%ls\\%ls\\%u.%u.%u.%u\\%ls\\%ls\\%ls_%zu.exe",
+		PICK(rng, VENDORS), PICK(rng, PRODUCTS),
+		(unsigned)(bench_rand(rng) % 200), (unsigned)(bench_rand(rng) % 10),
+		(unsigned)(bench_rand(rng) % 10000), (unsigned)(bench_rand(rng) % 1000),
+		PICK(rng, FOLDERS), PICK(rng, FOLDERS), PICK(rng, NAMES), index);
+}
+
+static void make_temp(wchar_t* dest, size_t count, size_t index, uint64_t* rng) {
+	swprintf(dest, count, L"c:\\users\\user%u\\appdata\\local\\temp\\%08llx\\%ls_%zu.exe",
+		(unsigned)(bench_rand(rng) % 8), (unsigned long long)(bench_rand(rng) & 0xFFFFFFFF),
+		PICK(rng, NAMES), index);
+}
+
+void bench_path_make(wchar_t* dest, size_t dest_count, enum BENCH_DIST dist, uint64_t seed, size_t index) {
+	uint64_t rng = seed ^ ((uint64_t)index * 0xD1B54A32D192ED03ULL);
+
+	switch (dist) {
+		case BENCH_DIST_SHORT:
+			make_short(dest, dest_count, index, &rng);
+			break;
+
+		case BENCH_DIST_DEEP:
+			make_deep(dest, dest_count, index, &rng);
+			break;
+
+		default:
+		{
+			uint64_t r = bench_rand(&rng) % 10;
+			if (r < 3) {
+				make_short(dest, dest_count, index, &rng);
+			} else if (r < 8) {
+				make_deep(dest, dest_count, index, &rng);
+			} else {
+				make_temp(dest, dest_count, index, &rng);
+			}
+		} break;
+	}
+}
+
+void bench_devpath(wchar_t* dev_path, size_t dev_path_count, wchar_t const* dos_path) {
+	swprintf(dev_path, dev_path_count, L"%ls%u%ls", DEVICE_PREFIX, (unsigned)(dos_path[0] - L'c' + 3), dos_path + 2);
+}
+
+bool bench_dos_device(wchar_t* dos_name, size_t dos_name_count, wchar_t const* dev_name) {
+	size_t prefix = wstr_len(DEVICE_PREFIX, BENCH_PATH_SIZE);
+	if (dos_name_count < 3 || wcsncmp(dev_name, DEVICE_PREFIX, prefix) != 0) {
+		return false;
+	}
+
+	wchar_t const* s = dev_name + prefix;
+	unsigned volume = 0;
+
+	while (*s >= L'0' && *s <= L'9') {
+		volume = volume * 10 + (unsigned)(*s - L'0');
+		++s;
+	}
+
+	if (*s != L'\0' || volume < 3 || volume > 25) {
+		return false;
+	}
+
+	dos_name[0] = (wchar_t)(L'c' + (volume - 3));
+	dos_name[1] = L':';
+	dos_name[2] = 0;
+
+	return true;
+}
+
+bool bench_environment(wchar_t* value, size_t value_count, wchar_t const* name) {
+	if (wcscmp(name, L"programfiles") == 0) {
+		return wstr_copy(value, value_count, L"C:\\Program Files");
+	}
+
+	if (wcscmp(name, L"systemroot") == 0 || wcscmp(name, L"windir") == 0) {
+		return wstr_copy(value, value_count, L"C:\\Windows");
+	}
+
+	return false;
+}
+
+bool bench_long_path(wchar_t* long_path, size_t long_path_count, wchar_t const* path) {
+	size_t prefix = wstr_len(SHORT_PROGRAM_FILES, BENCH_PATH_SIZE);
+	if (wcsncmp(path, SHORT_PROGRAM_FILES, prefix) != 0 || (path[prefix] != L'\\' && path[prefix] != L'\0')) {
+		return false;
+	}
+
+	return swprintf(long_path, long_path_count, L"c:\\program files%ls", path + prefix) > 0;
+}
+
+bool bench_file_id(uint64_t* volume, uint64_t* file, wchar_t const* path) {
+	if (path[0] < L'a' || path[0] > L'z' || path[1] != L':' || path[2] != L'\\') {
+		return false;
+	}
+
+	*volume = 0x5E1A0000 + (uint64_t)(path[0] - L'a');
+	*file = wstr_hash(path + 2);
+
+	return true;
+}
+
+struct path_resolvers const BENCH_PATH_RESOLVERS = {bench_dos_device, bench_environment, bench_long_path, NULL};
+
+/**
+ * Writes a path with a leading directory replaced, if it starts with it.
+ * Returns false if it does not.
+ */
+static bool replace_prefix(wchar_t* dest, size_t dest_count, wchar_t const* path, wchar_t const* prefix, wchar_t const* replacement) {
+	size_t len = wstr_len(prefix, BENCH_PATH_SIZE);
+	if (wcsncmp(path, prefix, len) != 0) {
+		return false;
+	}
+
+	swprintf(dest, dest_count, L"%ls%ls", replacement, path + len);
+	return true;
+}
+
+void bench_path_form(wchar_t* dest, size_t dest_count, wchar_t const* path, unsigned form) {
+	switch (form % BENCH_PATH_FORMS) {
+		case 1:
+			/* Upper case, as rules often keep it. */
+			for (size_t i = 0; i < dest_count; ++i) {
+				wchar_t c = path[i];
+				dest[i] = c >= L'a' && c <= L'z' ? (wchar_t)(c - 0x20) : c;
+				if (c == L'\0') {
+					break;
+				}
+			}
+			break;
+
+		case 2:
+			if (replace_prefix(dest, dest_count, path, L"c:\\program files\\", L"%ProgramFiles%\\") == false &&
+				replace_prefix(dest, dest_count, path, L"c:\\windows\\", L"%SystemRoot%\\") == false) {
+				swprintf(dest, dest_count, L"%%windir%%\\..%ls", path + 2);
+			}
+			break;
+
+		case 3:
+			swprintf(dest, dest_count, L"\\\\?\\%ls", path);
+			break;
+
+		case 4:
+			/* c:\.\dir\name.exe\\..\name.exe */
+			swprintf(dest, dest_count, L"c:\\.\\%ls\\\\..\\%ls", path + 3, wcsrchr(path, L'\\') + 1);
+			break;
+
+		case 5:
+			if (replace_prefix(dest, dest_count, path, L"c:\\program files\\", SHORT_PROGRAM_FILES L"\\") == false) {
+				/* Forward slashes. */
+				for (size_t i = 0; i < dest_count; ++i) {
+					dest[i] = path[i] == L'\\' ? L'/' : path[i];
+					if (path[i] == L'\0') {
+						break;
+					}
+				}
+			}
+			break;
+
+		default:
+			wstr_copy(dest, dest_count, path);
+			break;
+	}
+}
+
+void bench_rule(struct firewall_rule* rule, wchar_t const* path) {
+	rule->name = path;
+	rule->path = path;
+	rule->ports = NULL;
+	rule->outbound = true;
+	rule->enabled = true;
+	rule->allow = false;
+}
+
+bool bench_paths_create(struct bench_paths* paths, enum BENCH_DIST dist, uint64_t seed, size_t first, size_t count) {
+	paths->count = 0;
+	paths->items = calloc(count ? count : 1, sizeof(*paths->items));
+	if (paths->items == NULL) {
+		return false;
+	}
+
+	wchar_t buffer[BENCH_PATH_SIZE];
+
+	for (size_t i = 0; i < count; ++i) {
+		bench_path_make(buffer, BENCH_PATH_SIZE, dist, seed, first + i);
+
+		size_t len = wstr_len(buffer, BENCH_PATH_SIZE) + 1;
+		paths->items[i] = malloc(sizeof(wchar_t) * len);
+		if (paths->items[i] == NULL) {
+			bench_paths_destroy(paths);
+			return false;
+		}
+
+		wstr_copy(paths->items[i], len, buffer);
+		paths->count += 1;
+	}
+
+	return true;
+}
+
+void bench_paths_destroy(struct bench_paths* paths) {
+	for (size_t i = 0; i < paths->count; ++i) {
+		free(paths->items[i]);
+	}
+
+	free(paths->items);
+	paths->items = NULL;
+	paths->count = 0;
+}
+
+double bench_paths_mean_length(struct bench_paths const* paths) {
+	if (paths->count == 0) {
+		return 0.0;
+	}
+
+	double total = 0.0;
+	for (size_t i = 0; i < paths->count; ++i) {
+		total += (double)wstr_len(paths->items[i], BENCH_PATH_SIZE);
+	}
+
+	return total / (double)paths->count;
+}
+
+static int compare_samples(void const* a, void const* b) {
+	int64_t x = *(int64_t const*)a;
+	int64_t y = *(int64_t const*)b;
+	return (x > y) - (x < y);
+}
+
+int64_t bench_percentile(int64_t* samples, size_t count, double percentile) {
+	if (count == 0) {
+		return 0;
+	}
+
+	qsort(samples, count, sizeof(*samples), compare_samples);
+
+	size_t i = (size_t)(percentile / 100.0 * (double)(count - 1) + 0.5);
+	return samples[i < count ? i : count - 1];
+}
+
+void bench_report_begin(char const* name) {
+	g.open = true;
+	printf("{\"bench\":\"%s\"", name);
+}
+
+void bench_report_str(char const* key, char const* value) {
+	printf(",\"%s\":\"%s\"", key, value);
+}
+
+void bench_report_int(char const* key, int64_t value) {
+	printf(",\"%s\":%lld", key, (long long)value);
+}
+
+void bench_report_float(char const* key, double value) {
+	printf(",\"%s\":%.3f", key, value);
+}
+
+void bench_report_end(void) {
+	if (g.open) {
+		printf("}\n");
+		fflush(stdout);
+		g.open = false;
+	}
+}
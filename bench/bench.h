@@ -0,0 +1,146 @@
+#pragma once
+#include "firewall.h"
+#include "path.h"
+#include "types.h"
+
+/**
+ * Buffer size large enough for any generated path.
+ */
+#define BENCH_PATH_SIZE 512
+
+/**
+ * Path shape distributions used to generate benchmark inputs.
+ */
+enum BENCH_DIST
+{
+	BENCH_DIST_SHORT,	/* c:\windows\system32\*.exe */
+	BENCH_DIST_MIXED,	/* a blend resembling a real rule set */
+	BENCH_DIST_DEEP,	/* c:\program files\...\*.exe, 100+ characters */
+	BENCH_DIST_COUNT
+};
+
+/**
+ * A set of generated paths. Paths are lowercase, as they are stored in the cache.
+ */
+struct bench_paths {
+	wchar_t** items;
+	size_t count;
+};
+
+/**
+ * Returns the name of a distribution, for reporting.
+ */
+char const* bench_dist_name(enum BENCH_DIST dist);
+
+/**
+ * Returns the next value of a deterministic pseudo-random sequence (splitmix64).
+ */
+uint64_t bench_rand(uint64_t* state);
+
+/**
+ * Writes the path with the given index in a distribution. The same seed and
+ * index always produce the same path, and different indices never collide.
+ */
+void bench_path_make(wchar_t* dest, size_t dest_count, enum BENCH_DIST dist, uint64_t seed, size_t index);
+
+/**
+ * Converts a generated DOS path (eg. c:\...) into the NT device path
+ * (eg. \device\harddiskvolume3\...) a drop event would carry.
+ */
+void bench_devpath(wchar_t* dev_path, size_t dev_path_count, wchar_t const* dos_path);
+
+/**
+ * Fake device resolver for path_create, the inverse of bench_devpath. Maps
+ * \device\harddiskvolumeN to a drive letter, volume 3 being C:.
+ */
+bool bench_dos_device(wchar_t* dos_name, size_t dos_name_count, wchar_t const* dev_name);
+
+/**
+ * Fake environment for path_canonicalize: ProgramFiles is C:\Program Files,
+ * SystemRoot and windir are C:\Windows.
+ */
+bool bench_environment(wchar_t* value, size_t value_count, wchar_t const* name);
+
+/**
+ * Fake short name resolver for path_canonicalize, knowing c:\progra~1 as
+ * c:\program files.
+ */
+bool bench_long_path(wchar_t* long_path, size_t long_path_count, wchar_t const* path);
+
+/**
+ * Fake file identity resolver for path_identify: every path on a drive
+ * names an existing file, identified by its drive letter and the hash of the
+ * rest of the path.
+ */
+bool bench_file_id(uint64_t* volume, uint64_t* file, wchar_t const* path);
+
+/**
+ * The fake resolvers above but bench_file_id, for path_create. Tools keying
+ * the cache by file identity add it.
+ */
+extern struct path_resolvers const BENCH_PATH_RESOLVERS;
+
+/**
+ * Number of forms bench_path_form writes a path in.
+ */
+#define BENCH_PATH_FORMS 6
+
+/**
+ * Writes a generated path in one of the forms a firewall rule may name it
+ * by, eg. with environment variables, short names, a \\?\ prefix or
+ * redundant segments. path_canonicalize with the fake resolvers converts
+ * every form back to the path.
+ */
+void bench_path_form(wchar_t* dest, size_t dest_count, wchar_t const* path, unsigned form);
+
+/**
+ * Describes an enabled outbound rule blocking a path, named after it.
+ */
+void bench_rule(struct firewall_rule* rule, wchar_t const* path);
+
+/**
+ * Generates the count paths of a distribution starting at index first, as
+ * produced by bench_path_make. Returns false on allocation failure.
+ */
+bool bench_paths_create(struct bench_paths* paths, enum BENCH_DIST dist, uint64_t seed, size_t first, size_t count);
+
+/**
+ * Frees a generated path set.
+ */
+void bench_paths_destroy(struct bench_paths* paths);
+
+/**
+ * Returns the mean length of the paths in a set.
+ */
+double bench_paths_mean_length(struct bench_paths const* paths);
+
+/**
+ * Sorts a sample array in place and returns the value at the given
+ * percentile (0-100).
+ */
+int64_t bench_percentile(int64_t* samples, size_t count, double percentile);
+
+/**
+ * Starts a result record. Each record is written as one JSON object per line.
+ */
+void bench_report_begin(char const* name);
+
+/**
+ * Adds a string field to the current result record.
+ */
+void bench_report_str(char const* key, char const* value);
+
+/**
+ * Adds an integer field to the current result record.
+ */
+void bench_report_int(char const* key, int64_t value);
+
+/**
+ * Adds a floating point field to the current result record.
+ */
+void bench_report_float(char const* key, double value);
+
+/**
+ * Finishes and writes the current result record.
+ */
+void bench_report_end(void);
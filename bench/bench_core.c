@@ -0,0 +1,841 @@
+#include "bench.h"
+#include "cache.h"
+#include "memory.h"
+#include "platform.h"
+#include "queue.h"
+#include "wstr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Number of distinct paths cycled through by the string benchmarks.
+ */
+#define STRING_SET_SIZE 4096
+
+/**
+ * Names of the wstr_lower benchmarks by case folding implementation.
+ */
+static char const* const FOLD_NAMES[] = {"wstr_lower_scalar", "wstr_lower_sse2", "wstr_lower_avx2"};
+
+/**
+ * Characters along with what wstr_lower folds them to. Beyond ASCII they
+ * come from the FOLD_RUNS table, among them those Windows folds unlike
+ * plain lowercasing: the Kelvin and ohm signs, dotted capital I and capital
+ * sharp s stay as they are, dotless i, long s and final sigma fold along
+ * with their uppercase form.
+ */
+static wchar_t const FOLD_CASES[][2] = {
+	{L'A', L'a'}, {L'Z', L'z'}, {L'a', L'a'}, {L'@', L'@'}, {L'[', L'['}, {L'\\', L'\\'},
+	{0x00C0, 0x00E0}, {0x00DF, 0x00DF}, {0x0100, 0x0101}, {0x0130, 0x0130}, {0x0131, 0x0069},
+	{0x017F, 0x0073}, {0x01C4, 0x01C6}, {0x01C5, 0x01C6}, {0x03A3, 0x03C3}, {0x03C2, 0x03C3},
+	{0x1E9E, 0x1E9E}, {0x2126, 0x2126}, {0x212A, 0x212A}, {0xFF21, 0xFF41},
+};
+
+/**
+ * Longest string the case folding is verified on, several blocks of the
+ * widest vector, and the page size strings are also verified to end at.
+ */
+#define FOLD_CASE_LEN 80
+#define FOLD_PAGE_SIZE 4096
+
+/**
+ * Number of paths and buckets of the hash distribution benchmark. 2053 is
+ * the prime the cache once reduced hashes by.
+ */
+#define HASH_SET_SIZE 65536
+#define HASH_BUCKETS 4096
+#define HASH_PRIME_BUCKETS 2053
+
+/**
+ * Cache population sizes measured by the cache benchmarks.
+ */
+static size_t const CACHE_SIZES[] = {1024, 16384};
+
+/**
+ * Rule counts measured by the scaling benchmark.
+ */
+static size_t const RULE_COUNTS[] = {1000, 10000, 100000, 1000000};
+
+/**
+ * Number of individually timed lookups per scaling step.
+ */
+#define SCALING_SAMPLES 100000
+
+/**
+ * Seed of the synthetic rule source.
+ */
+#define RULE_SEED 0x5EED
+
+/**
+ * Snapshot file written and loaded by the scaling benchmark, in the
+ * working directory.
+ */
+#define SNAPSHOT_FILE_NAME "notifier_bench.snapshot"
+#define SNAPSHOT_FILE L"notifier_bench.snapshot"
+
+/**
+ * Accumulated time and allocations of a measured section.
+ */
+struct measure {
+	int64_t elapsed;
+	int64_t allocs;
+	int64_t frees;
+	int64_t start;
+	struct memory_stats mem;
+};
+
+static struct {
+	char const* filter;
+	size_t ops;
+	bool failed;
+	uint64_t volatile sink;
+} g;
+
+/**
+ * Returns true if the named benchmark should run.
+ */
+static bool selected(char const* name) {
+	return g.filter == NULL || strstr(name, g.filter) != NULL;
+}
+
+/**
+ * Starts (or resumes) measuring time and allocations.
+ */
+static void measure_start(struct measure* m) {
+	memory_get_total(&m->mem);
+	m->start = platform_time_ns();
+}
+
+/**
+ * Pauses measuring, accumulating the section since measure_start.
+ */
+static void measure_stop(struct measure* m) {
+	int64_t now = platform_time_ns();
+
+	struct memory_stats mem;
+	memory_get_total(&mem);
+
+	m->elapsed += now - m->start;
+	m->allocs += mem.allocs - m->mem.allocs;
+	m->frees += mem.frees - m->mem.frees;
+}
+
+/**
+ * Writes a result record for a measurement.
+ */
+static void report(char const* name, enum BENCH_DIST dist, size_t size, size_t ops, double mean_len, struct measure const* m) {
+	double count = (double)(ops ? ops : 1);
+
+	bench_report_begin(name);
+	bench_report_str("dist", bench_dist_name(dist));
+	bench_report_int("size", (int64_t)size);
+	bench_report_int("ops", (int64_t)ops);
+	bench_report_float("mean_len", mean_len);
+	bench_report_float("ns_per_op", (double)m->elapsed / count);
+	bench_report_float("allocs_per_op", (double)m->allocs / count);
+	bench_report_float("frees_per_op", (double)m->frees / count);
+	bench_report_end();
+}
+
+/**
+ * The FNV-1a hash wstr_hash used to be, as a reference.
+ */
+static uint64_t fnv1a_hash(wchar_t const* str) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; str[i]; ++i) {
+		hash ^= (uint64_t)str[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * Folds a string of the given length with the selected case folding, into
+ * every destination size from 1 to one past its length and in place, and
+ * checks the results against the expected folded string. The string is
+ * copied to an allocation of its own size, so a fold reading past it is
+ * caught by the address sanitizer.
+ */
+static bool check_fold(wchar_t const* src, size_t len, wchar_t const* expected) {
+	wchar_t* copy = malloc(sizeof(*copy) * (len + 1));
+	wchar_t* dest = malloc(sizeof(*dest) * (len + 1));
+	bool ok = copy && dest;
+
+	if (ok) {
+		memcpy(copy, src, sizeof(*src) * (len + 1));
+	}
+
+	/* A string that does not fit is cut short and still terminated. */
+	for (size_t count = 1; ok && count <= len + 1; ++count) {
+		size_t kept = count <= len ? count - 1 : len;
+
+		ok = wstr_lower_copy(dest, count, copy) == (count <= len ? count : len) && dest[kept] == 0 &&
+			memcmp(dest, expected, sizeof(*dest) * kept) == 0;
+	}
+
+	if (ok) {
+		wstr_lower(copy);
+		ok = memcmp(copy, expected, sizeof(*copy) * (len + 1)) == 0;
+	}
+
+	free(copy);
+	free(dest);
+
+	return ok;
+}
+
+/**
+ * Checks a case folding implementation against known folds: strings of
+ * every length up to FOLD_CASE_LEN in mixed case, with each character of
+ * FOLD_CASES at the start, the middle and the end, also ending right at a
+ * page boundary. Then checks that it folds the uppercase form of every
+ * path back to the path and hashes it like the scalar one.
+ */
+static bool verify_fold(struct bench_paths const* paths, enum WSTR_FOLD fold) {
+	static wchar_t const pattern[] = L"C:\\Program Files\\Vendor\\App.EXE";
+	size_t pattern_len = sizeof(pattern) / sizeof(pattern[0]) - 1;
+
+	wchar_t src[FOLD_CASE_LEN + 1];
+	wchar_t expected[FOLD_CASE_LEN + 1];
+	wchar_t* page = malloc(2 * FOLD_PAGE_SIZE);
+	bool ok = page != NULL;
+
+	wstr_fold_select(fold);
+
+	for (size_t len = 0; ok && len <= FOLD_CASE_LEN; ++len) {
+		for (size_t i = 0; i < len; ++i) {
+			src[i] = pattern[i % pattern_len];
+			expected[i] = src[i] >= L'A' && src[i] <= L'Z' ? (wchar_t)(src[i] + 0x20) : src[i];
+		}
+
+		src[len] = 0;
+		expected[len] = 0;
+
+		size_t positions[3];
+		positions[0] = 0;
+		positions[1] = len / 2;
+		positions[2] = len > 0 ? len - 1 : 0;
+
+		for (size_t c = 0; ok && len > 0 && c < sizeof(FOLD_CASES) / sizeof(FOLD_CASES[0]); ++c) {
+			for (size_t p = 0; ok && p < sizeof(positions) / sizeof(positions[0]); ++p) {
+				wchar_t saved_src = src[positions[p]];
+				wchar_t saved_expected = expected[positions[p]];
+
+				src[positions[p]] = FOLD_CASES[c][0];
+				expected[positions[p]] = FOLD_CASES[c][1];
+
+				ok = check_fold(src, len, expected);
+
+				/* The terminator is the last character of the page. */
+				if (ok) {
+					uintptr_t end = ((uintptr_t)page + 2 * FOLD_PAGE_SIZE) & ~(uintptr_t)(FOLD_PAGE_SIZE - 1);
+					wchar_t* at_end = (wchar_t*)end - (len + 1);
+
+					memcpy(at_end, src, sizeof(*src) * (len + 1));
+					wstr_lower(at_end);
+					ok = memcmp(at_end, expected, sizeof(*at_end) * (len + 1)) == 0;
+				}
+
+				if (ok == false) {
+					fprintf(stderr, "%s: folds U+%04X at %zu of %zu characters wrongly\n", FOLD_NAMES[fold], (unsigned)FOLD_CASES[c][0], positions[p], len);
+				}
+
+				src[positions[p]] = saved_src;
+				expected[positions[p]] = saved_expected;
+			}
+		}
+	}
+
+	free(page);
+
+	wchar_t upper[BENCH_PATH_SIZE];
+	wchar_t actual[BENCH_PATH_SIZE];
+
+	for (size_t i = 0; ok && i < paths->count; ++i) {
+		wchar_t const* path = paths->items[i];
+		size_t len = wstr_len(path, BENCH_PATH_SIZE);
+
+		for (size_t j = 0; j <= len; ++j) {
+			upper[j] = path[j] >= L'a' && path[j] <= L'z' ? (wchar_t)(path[j] - 0x20) : path[j];
+		}
+
+		uint64_t expected_hash = 0;
+		uint64_t actual_hash = 0;
+
+		wstr_fold_select(WSTR_FOLD_SCALAR);
+		wstr_lower_hash(actual, BENCH_PATH_SIZE, path, &expected_hash);
+		wstr_fold_select(fold);
+
+		ok = wstr_lower_hash(actual, BENCH_PATH_SIZE, upper, &actual_hash) == len && actual_hash == expected_hash &&
+			memcmp(actual, path, sizeof(*actual) * (len + 1)) == 0;
+
+		if (ok == false) {
+			fprintf(stderr, "%s: folds path %zu unlike the scalar implementation\n", FOLD_NAMES[fold], i);
+		}
+	}
+
+	if (ok == false) {
+		g.failed = true;
+	}
+
+	return ok;
+}
+
+static void bench_strings(enum BENCH_DIST dist) {
+	struct bench_paths paths;
+	if (bench_paths_create(&paths, dist, 1 + dist, 0, STRING_SET_SIZE) == false) {
+		return;
+	}
+
+	double mean_len = bench_paths_mean_length(&paths);
+
+	if (selected("wstr_hash")) {
+		struct measure m = {0};
+		uint64_t sum = 0;
+
+		measure_start(&m);
+		for (size_t i = 0; i < g.ops; ++i) {
+			sum += wstr_hash(paths.items[i % paths.count]);
+		}
+		measure_stop(&m);
+
+		report("wstr_hash", dist, paths.count, g.ops, mean_len, &m);
+		g.sink += sum;
+	}
+
+	if (selected("wstr_hash_len")) {
+		size_t* lengths = malloc(sizeof(*lengths) * paths.count);
+		struct measure m = {0};
+		uint64_t sum = 0;
+
+		for (size_t i = 0; lengths && i < paths.count; ++i) {
+			lengths[i] = wstr_len(paths.items[i], BENCH_PATH_SIZE);
+		}
+
+		measure_start(&m);
+		for (size_t i = 0; lengths && i < g.ops; ++i) {
+			sum += wstr_hash_len(paths.items[i % paths.count], lengths[i % paths.count]);
+		}
+		measure_stop(&m);
+
+		if (lengths) {
+			report("wstr_hash_len", dist, paths.count, g.ops, mean_len, &m);
+		}
+
+		g.sink += sum;
+		free(lengths);
+	}
+
+	if (selected("fnv1a_hash")) {
+		struct measure m = {0};
+		uint64_t sum = 0;
+
+		measure_start(&m);
+		for (size_t i = 0; i < g.ops; ++i) {
+			sum += fnv1a_hash(paths.items[i % paths.count]);
+		}
+		measure_stop(&m);
+
+		report("fnv1a_hash", dist, paths.count, g.ops, mean_len, &m);
+		g.sink += sum;
+	}
+
+	enum WSTR_FOLD best = wstr_fold_select(WSTR_FOLD_AVX2);
+
+	for (enum WSTR_FOLD fold = WSTR_FOLD_SCALAR; fold <= best; ++fold) {
+		if (selected(FOLD_NAMES[fold]) == false || verify_fold(&paths, fold) == false) {
+			continue;
+		}
+
+		struct measure m = {0};
+
+		wstr_fold_select(fold);
+		measure_start(&m);
+		for (size_t i = 0; i < g.ops; ++i) {
+			wstr_lower(paths.items[i % paths.count]);
+		}
+		measure_stop(&m);
+
+		report(FOLD_NAMES[fold], dist, paths.count, g.ops, mean_len, &m);
+	}
+
+	wstr_fold_select(best);
+
+	if (selected("wstr_dup")) {
+		struct measure m = {0};
+
+		measure_start(&m);
+		for (size_t i = 0; i < g.ops; ++i) {
+			wchar_t* dup = wstr_dup(paths.items[i % paths.count]);
+			g.sink += (uint64_t)dup[0];
+			memory_free(dup);
+		}
+		measure_stop(&m);
+
+		report("wstr_dup", dist, paths.count, g.ops, mean_len, &m);
+	}
+
+	bench_paths_destroy(&paths);
+}
+
+/**
+ * Returns the chi-squared statistic of bucket loads divided by its degrees
+ * of freedom, about 1 for hashes spread evenly and larger the worse.
+ */
+static double chi_squared(uint32_t const* loads, size_t buckets, size_t count) {
+	double expected = (double)count / (double)buckets;
+	double sum = 0;
+
+	for (size_t i = 0; i < buckets; ++i) {
+		double d = (double)loads[i] - expected;
+		sum += d * d / expected;
+	}
+
+	return sum / (double)(buckets - 1);
+}
+
+static int compare_hashes(void const* a, void const* b) {
+	uint64_t x = *(uint64_t const*)a;
+	uint64_t y = *(uint64_t const*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Reports how evenly a hash function spreads a set of paths: over buckets
+ * picked by its low bits, its high bits and modulo a prime, and how many
+ * paths share a full hash.
+ */
+static void report_distribution(char const* name, enum BENCH_DIST dist, struct bench_paths const* paths, uint64_t (*hash)(wchar_t const*)) {
+	uint64_t* hashes = malloc(sizeof(*hashes) * paths->count);
+	uint32_t* loads = calloc(3 * HASH_BUCKETS, sizeof(*loads));
+
+	if (hashes && loads) {
+		for (size_t i = 0; i < paths->count; ++i) {
+			hashes[i] = hash(paths->items[i]);
+			loads[hashes[i] & (HASH_BUCKETS - 1)] += 1;
+			loads[HASH_BUCKETS + (hashes[i] >> 52)] += 1;
+			loads[2 * HASH_BUCKETS + hashes[i] % HASH_PRIME_BUCKETS] += 1;
+		}
+
+		qsort(hashes, paths->count, sizeof(*hashes), compare_hashes);
+
+		size_t collisions = 0;
+		for (size_t i = 1; i < paths->count; ++i) {
+			collisions += hashes[i] == hashes[i - 1];
+		}
+
+		bench_report_begin("hash_distribution");
+		bench_report_str("hash", name);
+		bench_report_str("dist", bench_dist_name(dist));
+		bench_report_int("size", (int64_t)paths->count);
+		bench_report_int("buckets", HASH_BUCKETS);
+		bench_report_float("low_bits_chi2", chi_squared(loads, HASH_BUCKETS, paths->count));
+		bench_report_float("high_bits_chi2", chi_squared(loads + HASH_BUCKETS, HASH_BUCKETS, paths->count));
+		bench_report_float("prime_chi2", chi_squared(loads + 2 * HASH_BUCKETS, HASH_PRIME_BUCKETS, paths->count));
+		bench_report_int("collisions", (int64_t)collisions);
+		bench_report_end();
+	}
+
+	free(hashes);
+	free(loads);
+}
+
+static void bench_hash_distribution(enum BENCH_DIST dist) {
+	struct bench_paths paths;
+	if (bench_paths_create(&paths, dist, 1 + dist, 0, HASH_SET_SIZE) == false) {
+		return;
+	}
+
+	report_distribution("wstr_hash", dist, &paths, wstr_hash);
+	report_distribution("fnv1a_hash", dist, &paths, fnv1a_hash);
+
+	bench_paths_destroy(&paths);
+}
+
+/**
+ * Inserts every path of a set into the cache.
+ */
+static void fill_cache(struct bench_paths const* paths, int64_t time) {
+	for (size_t i = 0; i < paths->count; ++i) {
+		cache_insert(paths->items[i], time);
+	}
+}
+
+static void bench_cache(enum BENCH_DIST dist, size_t size) {
+	struct bench_paths paths;
+	if (bench_paths_create(&paths, dist, 100 + dist, 0, size) == false) {
+		return;
+	}
+
+	/* Misses share the shape of the hits but never match: .exe becomes .exx. */
+	struct bench_paths misses;
+	if (bench_paths_create(&misses, dist, 100 + dist, 0, size) == false) {
+		bench_paths_destroy(&paths);
+		return;
+	}
+
+	for (size_t i = 0; i < misses.count; ++i) {
+		size_t len = wstr_len(misses.items[i], BENCH_PATH_SIZE);
+		misses.items[i][len - 1] = L'x';
+	}
+
+	double mean_len = bench_paths_mean_length(&paths);
+	size_t rounds = g.ops / size ? g.ops / size : 1;
+
+	cache_clear();
+
+	if (selected("cache_insert")) {
+		struct measure m = {0};
+
+		for (size_t r = 0; r < rounds; ++r) {
+			cache_clear();
+
+			measure_start(&m);
+			fill_cache(&paths, 0);
+			measure_stop(&m);
+		}
+
+		report("cache_insert", dist, size, rounds * size, mean_len, &m);
+	}
+
+	/* The lookup benchmarks need a populated cache. */
+	cache_clear();
+	fill_cache(&paths, 0);
+
+	if (selected("cache_insert_existing")) {
+		struct measure m = {0};
+
+		measure_start(&m);
+		for (size_t i = 0; i < g.ops; ++i) {
+			cache_insert(paths.items[i % size], 1);
+		}
+		measure_stop(&m);
+
+		report("cache_insert_existing", dist, size, g.ops, mean_len, &m);
+	}
+
+	if (selected("cache_contains_hit")) {
+		struct measure m = {0};
+		size_t found = 0;
+
+		measure_start(&m);
+		for (size_t i = 0; i < g.ops; ++i) {
+			found += cache_contains(paths.items[i % size]);
+		}
+		measure_stop(&m);
+
+		report("cache_contains_hit", dist, size, g.ops, mean_len, &m);
+		g.sink += found;
+	}
+
+	if (selected("cache_contains_miss")) {
+		struct measure m = {0};
+		size_t found = 0;
+
+		measure_start(&m);
+		for (size_t i = 0; i < g.ops; ++i) {
+			found += cache_contains(misses.items[i % size]);
+		}
+		measure_stop(&m);
+
+		report("cache_contains_miss", dist, size, g.ops, mean_len, &m);
+		g.sink += found;
+	}
+
+	if (selected("cache_prune_keep")) {
+		/* Nothing is old enough to be removed, this is the fixed cost of a prune. */
+		struct measure m = {0};
+
+		measure_start(&m);
+		for (size_t r = 0; r < rounds; ++r) {
+			cache_prune(2, 100);
+		}
+		measure_stop(&m);
+
+		report("cache_prune_keep", dist, size, rounds, mean_len, &m);
+	}
+
+	if (selected("cache_prune_all")) {
+		struct measure m = {0};
+
+		for (size_t r = 0; r < rounds; ++r) {
+			cache_clear();
+			fill_cache(&paths, 0);
+
+			measure_start(&m);
+			cache_prune(1000, 100);
+			measure_stop(&m);
+		}
+
+		report("cache_prune_all", dist, size, rounds, mean_len, &m);
+	}
+
+	if (selected("cache_clear")) {
+		struct measure m = {0};
+
+		for (size_t r = 0; r < rounds; ++r) {
+			cache_clear();
+			fill_cache(&paths, 0);
+
+			measure_start(&m);
+			cache_clear();
+			measure_stop(&m);
+		}
+
+		report("cache_clear", dist, size, rounds, mean_len, &m);
+	}
+
+	cache_clear();
+	bench_paths_destroy(&misses);
+	bench_paths_destroy(&paths);
+}
+
+static void bench_queue(void) {
+	if (selected("queue_roundtrip") == false) {
+		return;
+	}
+
+	wchar_t item[] = L"c:\\windows\\system32\\svchost.exe";
+	struct measure m = {0};
+
+	queue_create();
+
+	measure_start(&m);
+	for (size_t i = 0; i < g.ops; ++i) {
+		queue_enqueue(item, sizeof(item) / sizeof(item[0]) - 1);
+
+		wchar_t* path = queue_dequeue();
+		g.sink += (uint64_t)path[0];
+		memory_free(path);
+	}
+	measure_stop(&m);
+
+	report("queue_roundtrip", BENCH_DIST_SHORT, 1, g.ops, 0.0, &m);
+
+	queue_destroy();
+}
+
+/**
+ * Synthetic rule source, enumerates count rules like firewall_enum does into
+ * the snapshot. Without one the rules are only produced.
+ */
+static void rule_source(enum BENCH_DIST dist, size_t count, struct cache_snapshot* snapshot) {
+	wchar_t path[BENCH_PATH_SIZE];
+
+	for (size_t i = 0; i < count; ++i) {
+		bench_path_make(path, BENCH_PATH_SIZE, dist, RULE_SEED, i);
+
+		if (snapshot) {
+			cache_snapshot_insert(snapshot, path);
+		} else {
+			g.sink += (uint64_t)path[0];
+		}
+	}
+}
+
+/**
+ * Times individual lookups of random rules, hits or misses.
+ * Writes the p50, p99 and p999 latencies to the current record.
+ */
+static void sample_lookups(enum BENCH_DIST dist, size_t count, bool hits, int64_t* samples) {
+	uint64_t rng = hits ? 1 : 2;
+	wchar_t path[BENCH_PATH_SIZE];
+	size_t found = 0;
+
+	for (size_t i = 0; i < SCALING_SAMPLES; ++i) {
+		bench_path_make(path, BENCH_PATH_SIZE, dist, RULE_SEED, bench_rand(&rng) % count);
+
+		if (hits == false) {
+			path[wstr_len(path, BENCH_PATH_SIZE) - 1] = L'x';
+		}
+
+		int64_t start = platform_time_ns();
+		found += cache_contains(path);
+		samples[i] = platform_time_ns() - start;
+	}
+
+	g.sink += found;
+
+	char const* keys[2][3] = {
+		{"miss_p50_ns", "miss_p99_ns", "miss_p999_ns"},
+		{"hit_p50_ns", "hit_p99_ns", "hit_p999_ns"}
+	};
+
+	bench_report_int(keys[hits][0], bench_percentile(samples, SCALING_SAMPLES, 50.0));
+	bench_report_int(keys[hits][1], bench_percentile(samples, SCALING_SAMPLES, 99.0));
+	bench_report_int(keys[hits][2], bench_percentile(samples, SCALING_SAMPLES, 99.9));
+}
+
+/**
+ * Fills the cache from the synthetic rule source at increasing rule counts
+ * and reports build, publish, lookup, rebuild, save and load costs along
+ * with the memory footprint.
+ */
+static void bench_scaling(enum BENCH_DIST dist, size_t max_rules) {
+	int64_t* samples = malloc(sizeof(*samples) * SCALING_SAMPLES);
+	if (samples == NULL) {
+		return;
+	}
+
+	cache_clear();
+
+	for (size_t r = 0; r < sizeof(RULE_COUNTS) / sizeof(RULE_COUNTS[0]); ++r) {
+		size_t count = RULE_COUNTS[r];
+		if (count > max_rules) {
+			break;
+		}
+
+		struct memory_stats before;
+		memory_get_total(&before);
+		memory_reset_peak();
+
+		int64_t pool_before = memory_pool_bytes();
+
+		/* The cost of producing the rules alone, to separate it from the build. */
+		int64_t start = platform_time_ns();
+		rule_source(dist, count, NULL);
+		int64_t source_ns = platform_time_ns() - start;
+
+		start = platform_time_ns();
+		struct cache_snapshot* snapshot = cache_snapshot_create();
+		rule_source(dist, count, snapshot);
+		int64_t build_ns = platform_time_ns() - start;
+
+		start = platform_time_ns();
+		cache_publish(snapshot);
+		int64_t publish_ns = platform_time_ns() - start;
+
+		struct memory_stats built;
+		memory_get_total(&built);
+
+		struct memory_stats cache;
+		memory_get_stats(MEMORY_TAG_CACHE, &cache);
+
+		bench_report_begin("scaling");
+		bench_report_str("dist", bench_dist_name(dist));
+		bench_report_int("rules", (int64_t)count);
+		bench_report_int("source_ns", source_ns);
+		bench_report_int("build_ns", build_ns);
+		bench_report_float("insert_ns_per_rule", (double)(build_ns - source_ns) / (double)count);
+		bench_report_int("publish_ns", publish_ns);
+
+		sample_lookups(dist, count, true, samples);
+		sample_lookups(dist, count, false, samples);
+
+		/* A periodic refresh: the rules are enumerated into a new snapshot
+		 * which replaces the current one, releasing it. */
+		start = platform_time_ns();
+		snapshot = cache_snapshot_create();
+		rule_source(dist, count, snapshot);
+		cache_publish(snapshot);
+		bench_report_int("rebuild_ns", platform_time_ns() - start);
+
+		struct memory_stats after;
+		memory_get_total(&after);
+
+		/* Startup from a saved snapshot: mapping and checking the file
+		 * instead of enumerating the rules. */
+		start = platform_time_ns();
+		bool saved = cache_save(SNAPSHOT_FILE);
+		bench_report_int("save_ns", platform_time_ns() - start);
+
+		start = platform_time_ns();
+		snapshot = saved ? cache_snapshot_load(SNAPSHOT_FILE) : NULL;
+		cache_publish(snapshot);
+		bench_report_int("load_ns", snapshot ? platform_time_ns() - start : -1);
+		remove(SNAPSHOT_FILE_NAME);
+
+		bench_report_int("live_bytes", built.live_bytes - before.live_bytes);
+		bench_report_int("peak_bytes", after.peak_bytes - before.live_bytes);
+		bench_report_int("cache_bytes", cache.live_bytes);
+		bench_report_int("pool_growth_bytes", memory_pool_bytes() - pool_before);
+		bench_report_float("bytes_per_entry", (double)cache.live_bytes / (double)count);
+		bench_report_float("allocs_per_entry", (double)(built.allocs - before.allocs) / (double)count);
+		bench_report_end();
+
+		cache_publish(NULL);
+	}
+
+	free(samples);
+}
+
+static void usage(void) {
+	fprintf(stderr,
+		"usage: notifier_bench [--filter NAME] [--ops COUNT]\n"
+		"       notifier_bench --scaling [--dist short|mixed|deep] [--max-rules COUNT]\n"
+		"  Runs the cache, queue and string microbenchmarks, or with --scaling\n"
+		"  fills the cache with 1k to 1M synthetic rules and reports the build,\n"
+		"  lookup and rebuild costs along with the memory footprint. Results are\n"
+		"  written to stdout as one JSON object per line.\n");
+}
+
+int main(int argc, char** argv) {
+	bool scaling = false;
+	enum BENCH_DIST dist = BENCH_DIST_MIXED;
+	size_t max_rules = SIZE_MAX;
+
+	g.ops = 1000000;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+			g.filter = argv[++i];
+		} else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+			g.ops = (size_t)strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--scaling") == 0) {
+			scaling = true;
+		} else if (strcmp(argv[i], "--max-rules") == 0 && i + 1 < argc) {
+			max_rules = (size_t)strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--dist") == 0 && i + 1 < argc) {
+			char const* name = argv[++i];
+			dist = BENCH_DIST_COUNT;
+
+			for (int d = 0; d < BENCH_DIST_COUNT; ++d) {
+				if (strcmp(name, bench_dist_name((enum BENCH_DIST)d)) == 0) {
+					dist = (enum BENCH_DIST)d;
+				}
+			}
+
+			if (dist == BENCH_DIST_COUNT) {
+				usage();
+				return 1;
+			}
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (g.ops == 0) {
+		usage();
+		return 1;
+	}
+
+	if (scaling) {
+		bench_scaling(dist, max_rules);
+		return 0;
+	}
+
+	for (int d = 0; d < BENCH_DIST_COUNT; ++d) {
+		bench_strings((enum BENCH_DIST)d);
+	}
+
+	if (selected("hash_distribution")) {
+		for (int d = 0; d < BENCH_DIST_COUNT; ++d) {
+			bench_hash_distribution((enum BENCH_DIST)d);
+		}
+	}
+
+	for (int d = 0; d < BENCH_DIST_COUNT; ++d) {
+		for (size_t s = 0; s < sizeof(CACHE_SIZES) / sizeof(CACHE_SIZES[0]); ++s) {
+			bench_cache((enum BENCH_DIST)d, CACHE_SIZES[s]);
+		}
+	}
+
+	bench_queue();
+
+	/* A case folding that failed verification fails the run. */
+	return g.failed ? 1 : 0;
+}
@@ -0,0 +1,543 @@
+#include "bench.h"
+#include "config.h"
+#include "engine.h"
+#include "memory.h"
+#include "path.h"
+#include "platform.h"
+#include "wstr.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+/**
+ * Seeds of the synthetic rule set and the unknown applications.
+ */
+#define RULE_SEED 0x5EED
+#define APP_SEED 0xA995
+
+/**
+ * Index offsets keeping generated unknown applications distinct from rules.
+ */
+#define APP_INDEX_BASE 1000000000
+#define UNIQUE_INDEX_BASE 2000000000
+
+/**
+ * Maximum number of scripted notification actions.
+ */
+#define MAX_ACTIONS 32
+
+/**
+ * Simulation options.
+ */
+struct options {
+	char const* replay;
+	enum BENCH_DIST dist;
+	size_t rules;
+	size_t apps;
+	double hours;
+	double rate;
+	double hit_ratio;
+	double unique_ratio;
+	int64_t response_ms;
+	enum NOTIFIER_ACTION actions[MAX_ACTIONS];
+	size_t action_count;
+	uint64_t seed;
+	bool watch;
+	char const* snapshot;
+	bool forms;
+	bool file_ids;
+};
+
+/**
+ * Simulation state: the virtual clock and the fake firewall and notifier.
+ */
+static struct {
+	struct options opt;
+	int64_t now;
+	int64_t busy_until;
+	size_t next_action;
+	wchar_t** added;
+	size_t added_count;
+	size_t added_capacity;
+	size_t rules_enumerated;
+	firewall_change_t change_callback;
+	int64_t max_event_ns;
+} g;
+
+static int64_t sim_time(void) {
+	return g.now;
+}
+
+static bool sim_rules_enum(firewall_callback_t enum_callback) {
+	wchar_t path[BENCH_PATH_SIZE];
+	struct firewall_rule rule;
+
+	wchar_t form[BENCH_PATH_SIZE];
+
+	for (size_t i = 0; i < g.opt.rules; ++i) {
+		bench_path_make(path, BENCH_PATH_SIZE, g.opt.dist, RULE_SEED, i);
+
+		if (g.opt.forms) {
+			bench_path_form(form, BENCH_PATH_SIZE, path, (unsigned)i);
+			bench_rule(&rule, form);
+		} else {
+			bench_rule(&rule, path);
+		}
+
+		enum_callback(&rule);
+	}
+
+	for (size_t i = 0; i < g.added_count; ++i) {
+		bench_rule(&rule, g.added[i]);
+		enum_callback(&rule);
+	}
+
+	g.rules_enumerated += g.opt.rules + g.added_count;
+
+	return true;
+}
+
+static bool sim_rules_watch(firewall_change_t change_callback) {
+	g.change_callback = change_callback;
+	return true;
+}
+
+static void sim_rules_unwatch(void) {
+	g.change_callback = NULL;
+}
+
+static bool sim_rules_add(wchar_t const* name, wchar_t const* path, bool allow) {
+	(void)name;
+	(void)allow;
+
+	if (g.added_count == g.added_capacity) {
+		size_t capacity = g.added_capacity ? g.added_capacity * 2 : 64;
+		wchar_t** added = realloc(g.added, sizeof(*added) * capacity);
+		if (added == NULL) {
+			return false;
+		}
+
+		g.added = added;
+		g.added_capacity = capacity;
+	}
+
+	size_t count = wstr_len(path, MAX_EXT_PATH) + 1;
+	wchar_t* copy = malloc(sizeof(*copy) * count);
+	if (copy == NULL) {
+		return false;
+	}
+
+	wstr_copy(copy, count, path);
+	wstr_lower(copy);
+	g.added[g.added_count++] = copy;
+
+	/* A rule store signals a single edit several times, eg. for each value written. */
+	if (g.change_callback) {
+		g.change_callback();
+		g.change_callback();
+	}
+
+	return true;
+}
+
+static enum NOTIFIER_ACTION sim_notify(wchar_t const* path) {
+	(void)path;
+
+	enum NOTIFIER_ACTION action = g.opt.actions[g.next_action];
+	g.next_action = (g.next_action + 1) % g.opt.action_count;
+
+	return action;
+}
+
+/**
+ * Lets the fake notifier work through the queue up to the given time. Each
+ * notification keeps the notifier busy for the scripted response time.
+ */
+static void notifier_advance(int64_t time) {
+	while (g.busy_until <= time) {
+		if (g.busy_until > g.now) {
+			g.now = g.busy_until;
+		}
+
+		if (engine_notify(false) == false) {
+			break;
+		}
+
+		g.busy_until = g.now + g.opt.response_ms;
+	}
+
+	g.now = time;
+}
+
+/**
+ * Feeds a single event through the engine at the given time.
+ */
+static void sim_event(int64_t time, wchar_t const* dev_path) {
+	notifier_advance(time);
+
+	/* The refresher would run in the background, drive it by the virtual clock. */
+	engine_refresh();
+
+	int64_t start = platform_time_ns();
+	engine_drop_event(dev_path);
+	int64_t elapsed = platform_time_ns() - start;
+
+	if (elapsed > g.max_event_ns) {
+		g.max_event_ns = elapsed;
+	}
+
+	notifier_advance(time);
+}
+
+/**
+ * Generates the configured traffic: known rules, a skewed pool of unknown
+ * applications and uniquely named temporary executables.
+ */
+static size_t sim_generate(void) {
+	uint64_t rng = g.opt.seed;
+	int64_t end = (int64_t)(g.opt.hours * 3600000.0);
+	double time = 0.0;
+	size_t events = 0;
+	size_t unique = 0;
+
+	wchar_t path[BENCH_PATH_SIZE];
+	wchar_t dev_path[BENCH_PATH_SIZE + 32];
+
+	for (;;) {
+		/* Exponential inter-arrival times give a Poisson arrival process. */
+		double u = ((double)(bench_rand(&rng) >> 11) + 0.5) / 9007199254740992.0;
+		time += -log(u) * 1000.0 / g.opt.rate;
+
+		if ((int64_t)time >= end) {
+			break;
+		}
+
+		double pick = (double)(bench_rand(&rng) >> 11) / 9007199254740992.0;
+
+		if (pick < g.opt.hit_ratio && g.opt.rules > 0) {
+			bench_path_make(path, BENCH_PATH_SIZE, g.opt.dist, RULE_SEED, bench_rand(&rng) % g.opt.rules);
+		} else if (pick < g.opt.hit_ratio + g.opt.unique_ratio || g.opt.apps == 0) {
+			swprintf(path, BENCH_PATH_SIZE, L"c:\\users\\user\\appdata\\local\\temp\\%zu\\setup.exe", UNIQUE_INDEX_BASE + unique++);
+		} else {
+			/* Squaring skews the pool so a few applications are most of the traffic. */
+			double v = (double)(bench_rand(&rng) >> 11) / 9007199254740992.0;
+			size_t app = (size_t)(v * v * (double)g.opt.apps);
+			bench_path_make(path, BENCH_PATH_SIZE, g.opt.dist, APP_SEED, APP_INDEX_BASE + app);
+		}
+
+		bench_devpath(dev_path, BENCH_PATH_SIZE + 32, path);
+		sim_event((int64_t)time, dev_path);
+		events += 1;
+	}
+
+	notifier_advance(end);
+
+	return events;
+}
+
+/**
+ * Decodes a UTF-8 line into a wide string, stopping at the line end.
+ */
+static void decode_utf8(wchar_t* dest, size_t dest_count, char const* src) {
+	unsigned char const* s = (unsigned char const*)src;
+	size_t n = 0;
+
+	while (*s && *s != '\r' && *s != '\n' && n + 2 < dest_count) {
+		uint32_t c = *s++;
+		int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+
+		c &= extra ? (0x3F >> extra) : 0x7F;
+		while (extra-- > 0 && (*s & 0xC0) == 0x80) {
+			c = (c << 6) | (*s++ & 0x3F);
+		}
+
+		if (c > 0xFFFF && sizeof(wchar_t) == 2) {
+			c -= 0x10000;
+			dest[n++] = (wchar_t)(0xD800 + (c >> 10));
+			dest[n++] = (wchar_t)(0xDC00 + (c & 0x3FF));
+		} else {
+			dest[n++] = (wchar_t)c;
+		}
+	}
+
+	dest[n] = 0;
+}
+
+/**
+ * Replays a recorded event stream. Each line holds a time in milliseconds
+ * and a device path separated by a tab.
+ */
+static size_t sim_replay(char const* file_name) {
+	FILE* file = fopen(file_name, "r");
+	if (file == NULL) {
+		fprintf(stderr, "notifier_sim: unable to open %s\n", file_name);
+		return 0;
+	}
+
+	static char line[MAX_EXT_PATH * 4];
+	static wchar_t dev_path[MAX_EXT_PATH];
+	size_t events = 0;
+	int64_t last = 0;
+
+	while (fgets(line, sizeof(line), file)) {
+		char* tab = strchr(line, '\t');
+		if (tab == NULL) {
+			continue;
+		}
+
+		int64_t time = strtoll(line, NULL, 10);
+		if (time < last) {
+			time = last;
+		}
+
+		decode_utf8(dev_path, MAX_EXT_PATH, tab + 1);
+		sim_event(time, dev_path);
+
+		last = time;
+		events += 1;
+	}
+
+	fclose(file);
+	notifier_advance(last);
+
+	return events;
+}
+
+/**
+ * Parses a comma separated list of notification actions.
+ */
+static bool parse_actions(char const* list) {
+	g.opt.action_count = 0;
+
+	while (*list && g.opt.action_count < MAX_ACTIONS) {
+		size_t len = strcspn(list, ",");
+
+		if (len == 5 && strncmp(list, "allow", len) == 0) {
+			g.opt.actions[g.opt.action_count++] = NOTIFIER_ACTION_ALLOW;
+		} else if (len == 5 && strncmp(list, "block", len) == 0) {
+			g.opt.actions[g.opt.action_count++] = NOTIFIER_ACTION_BLOCK;
+		} else if (len == 4 && strncmp(list, "skip", len) == 0) {
+			g.opt.actions[g.opt.action_count++] = NOTIFIER_ACTION_SKIP;
+		} else {
+			return false;
+		}
+
+		list += len;
+		if (*list == ',') {
+			++list;
+		}
+	}
+
+	return g.opt.action_count > 0;
+}
+
+static void usage(void) {
+	fprintf(stderr,
+		"usage: notifier_sim [options]\n"
+		"  Replays drop events through the engine against a virtual clock, a\n"
+		"  fake firewall and a scripted notifier. Results are written to stdout\n"
+		"  as one JSON object.\n"
+		"\n"
+		"  --replay FILE       replay recorded events (ms<TAB>device path per line)\n"
+		"  --hours H           generated traffic duration (default 8)\n"
+		"  --rate N            generated events per second (default 20)\n"
+		"  --hit-ratio R       fraction of events for known rules (default 0.9)\n"
+		"  --unique-ratio R    fraction of uniquely named executables (default 0.01)\n"
+		"  --apps N            size of the unknown application pool (default 200)\n"
+		"  --rules N           number of synthetic firewall rules (default 2000)\n"
+		"  --dist NAME         rule path distribution: short, mixed, deep (default mixed)\n"
+		"  --actions LIST      notification actions, cycled (default block,allow,skip)\n"
+		"  --response-ms N     time each notification stays open (default 5000)\n"
+		"  --seed N            traffic generator seed (default 1)\n"
+		"  --refresh MODE      poll at an adaptive interval, or watch for rule changes (default poll)\n"
+		"  --snapshot FILE     start from the rule snapshot saved in FILE and save it there (default none)\n"
+		"  --keys MODE         key the cache by path, or by file identity (default path)\n"
+		"  --rule-paths MODE   rule paths as generated (plain), or in the varied forms rules name\n"
+		"                      them by, with variables, short names and redundant segments (default plain)\n");
+}
+
+static bool parse_options(int argc, char** argv) {
+	g.opt.dist = BENCH_DIST_MIXED;
+	g.opt.rules = 2000;
+	g.opt.apps = 200;
+	g.opt.hours = 8.0;
+	g.opt.rate = 20.0;
+	g.opt.hit_ratio = 0.9;
+	g.opt.unique_ratio = 0.01;
+	g.opt.response_ms = 5000;
+	g.opt.seed = 1;
+	parse_actions("block,allow,skip");
+
+	for (int i = 1; i < argc; ++i) {
+		char const* arg = argv[i];
+		char const* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (value == NULL) {
+			return false;
+		}
+
+		if (strcmp(arg, "--replay") == 0) {
+			g.opt.replay = value;
+		} else if (strcmp(arg, "--hours") == 0) {
+			g.opt.hours = atof(value);
+		} else if (strcmp(arg, "--rate") == 0) {
+			g.opt.rate = atof(value);
+		} else if (strcmp(arg, "--hit-ratio") == 0) {
+			g.opt.hit_ratio = atof(value);
+		} else if (strcmp(arg, "--unique-ratio") == 0) {
+			g.opt.unique_ratio = atof(value);
+		} else if (strcmp(arg, "--apps") == 0) {
+			g.opt.apps = (size_t)strtoull(value, NULL, 10);
+		} else if (strcmp(arg, "--rules") == 0) {
+			g.opt.rules = (size_t)strtoull(value, NULL, 10);
+		} else if (strcmp(arg, "--response-ms") == 0) {
+			g.opt.response_ms = strtoll(value, NULL, 10);
+		} else if (strcmp(arg, "--seed") == 0) {
+			g.opt.seed = strtoull(value, NULL, 10);
+		} else if (strcmp(arg, "--refresh") == 0) {
+			if (strcmp(value, "poll") == 0) {
+				g.opt.watch = false;
+			} else if (strcmp(value, "watch") == 0) {
+				g.opt.watch = true;
+			} else {
+				return false;
+			}
+		} else if (strcmp(arg, "--snapshot") == 0) {
+			g.opt.snapshot = value;
+		} else if (strcmp(arg, "--keys") == 0) {
+			if (strcmp(value, "path") == 0) {
+				g.opt.file_ids = false;
+			} else if (strcmp(value, "identity") == 0) {
+				g.opt.file_ids = true;
+			} else {
+				return false;
+			}
+		} else if (strcmp(arg, "--rule-paths") == 0) {
+			if (strcmp(value, "plain") == 0) {
+				g.opt.forms = false;
+			} else if (strcmp(value, "forms") == 0) {
+				g.opt.forms = true;
+			} else {
+				return false;
+			}
+		} else if (strcmp(arg, "--actions") == 0) {
+			if (parse_actions(value) == false) {
+				return false;
+			}
+		} else if (strcmp(arg, "--dist") == 0) {
+			g.opt.dist = BENCH_DIST_COUNT;
+			for (int d = 0; d < BENCH_DIST_COUNT; ++d) {
+				if (strcmp(value, bench_dist_name((enum BENCH_DIST)d)) == 0) {
+					g.opt.dist = (enum BENCH_DIST)d;
+				}
+			}
+
+			if (g.opt.dist == BENCH_DIST_COUNT) {
+				return false;
+			}
+		} else {
+			return false;
+		}
+
+		++i;
+	}
+
+	return g.opt.rate > 0.0 && g.opt.hours >= 0.0 && g.opt.response_ms >= 0;
+}
+
+int main(int argc, char** argv) {
+	if (parse_options(argc, argv) == false) {
+		usage();
+		return 1;
+	}
+
+	struct engine_hooks hooks = {0};
+	hooks.time = sim_time;
+	hooks.dospath = devpath_normalize;
+	hooks.rules_enum = sim_rules_enum;
+	hooks.rules_add = sim_rules_add;
+	hooks.notify = sim_notify;
+
+	if (g.opt.watch) {
+		hooks.rules_watch = sim_rules_watch;
+		hooks.rules_unwatch = sim_rules_unwatch;
+	}
+
+	struct path_resolvers resolvers = BENCH_PATH_RESOLVERS;
+	if (g.opt.file_ids) {
+		resolvers.file_id = bench_file_id;
+	}
+
+	path_create(&resolvers);
+	engine_create(&hooks);
+
+	/* As in the application, a loaded snapshot serves the first events and
+	 * the first refresh enumerates the rules. */
+	bool loaded = false;
+	if (g.opt.snapshot) {
+		wchar_t path[4096];
+		decode_utf8(path, sizeof(path) / sizeof(path[0]), g.opt.snapshot);
+		loaded = engine_load(path);
+	}
+
+	engine_watch();
+	if (loaded == false) {
+		engine_rebuild();
+	}
+
+	int64_t start = platform_time_ns();
+	size_t events = g.opt.replay ? sim_replay(g.opt.replay) : sim_generate();
+	int64_t elapsed = platform_time_ns() - start;
+
+	struct engine_stats stats;
+	engine_get_stats(&stats);
+
+	double seconds = (double)elapsed / 1e9;
+
+	bench_report_begin("sim");
+	bench_report_str("source", g.opt.replay ? "replay" : "generated");
+	bench_report_str("refresh", g.opt.watch ? "watch" : "poll");
+	bench_report_str("snapshot", g.opt.snapshot == NULL ? "none" : loaded ? "loaded" : "missing");
+	bench_report_str("keys", g.opt.file_ids ? "identity" : "path");
+	bench_report_str("rule_paths", g.opt.forms ? "forms" : "plain");
+	bench_report_float("sim_hours", (double)g.now / 3600000.0);
+	bench_report_float("wall_seconds", seconds);
+	bench_report_float("events_per_sec", seconds > 0.0 ? (double)events / seconds : 0.0);
+	bench_report_int("events", stats.events);
+	bench_report_int("invalid_paths", stats.invalid_paths);
+	bench_report_int("cache_hits", stats.cache_hits);
+	bench_report_int("cache_misses", stats.cache_misses);
+	bench_report_int("rebuilds", stats.rebuilds);
+	bench_report_int("rules_enumerated", (int64_t)g.rules_enumerated);
+	bench_report_int("rule_changes", stats.rule_changes);
+	bench_report_int("refresh_interval", stats.refresh_interval);
+	bench_report_int("churn_refreshes", stats.churn_refreshes);
+	bench_report_int("rule_churn", stats.rule_churn);
+	bench_report_int("expired", stats.expired);
+	bench_report_int("evictions", stats.evictions);
+	bench_report_int("runtime_entries", stats.runtime_entries);
+	bench_report_int("runtime_bytes", stats.runtime_bytes);
+	bench_report_int("queue_drops", stats.queue_drops);
+	bench_report_int("notifications", stats.notifications);
+	bench_report_int("rules_added", stats.rules_added);
+	bench_report_int("rule_paths_added", stats.rule_paths_added);
+	bench_report_int("rule_paths_removed", stats.rule_paths_removed);
+	bench_report_int("rule_ids_added", stats.rule_ids_added);
+	bench_report_int("rule_ids_removed", stats.rule_ids_removed);
+	bench_report_int("max_event_ns", g.max_event_ns);
+	bench_report_end();
+
+	engine_close();
+	engine_destroy();
+	path_destroy();
+
+	for (size_t i = 0; i < g.added_count; ++i) {
+		free(g.added[i]);
+	}
+
+	free(g.added);
+
+	return 0;
+}
@@ -0,0 +1,362 @@
+#include "bench.h"
+#include "config.h"
+#include "engine.h"
+#include "path.h"
+#include "platform.h"
+#include "wstr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+/**
+ * Seeds of the synthetic rule set and the unknown applications.
+ */
+#define RULE_SEED 0x5EED
+#define APP_SEED 0xA995
+
+/**
+ * Index offsets keeping generated unknown applications distinct from rules.
+ */
+#define APP_INDEX_BASE 1000000000
+#define UNIQUE_INDEX_BASE 2000000000
+
+/**
+ * Maximum number of storm threads.
+ */
+#define MAX_THREADS 256
+
+/**
+ * Storm options.
+ */
+struct options {
+	size_t threads;
+	size_t events;
+	size_t rules;
+	size_t cardinality;
+	double hit_ratio;
+	int64_t invalidate_ms;
+	enum BENCH_DIST dist;
+	uint64_t seed;
+	bool file_ids;
+};
+
+/**
+ * Per thread state. Padded so threads never share a cache line.
+ */
+struct worker {
+	platform_thread_t thread;
+	size_t index;
+	int64_t* samples;
+	uint8_t padding[64];
+};
+
+static struct {
+	struct options opt;
+	struct bench_paths hits;
+	struct bench_paths misses;
+	struct worker workers[MAX_THREADS];
+	int64_t volatile ready;
+	int64_t volatile go;
+	int64_t volatile done;
+	int64_t volatile unique;
+} g;
+
+static bool storm_rules_enum(firewall_callback_t enum_callback) {
+	wchar_t path[BENCH_PATH_SIZE];
+	struct firewall_rule rule;
+
+	for (size_t i = 0; i < g.opt.rules; ++i) {
+		bench_path_make(path, BENCH_PATH_SIZE, g.opt.dist, RULE_SEED, i);
+		bench_rule(&rule, path);
+		enum_callback(&rule);
+	}
+
+	return true;
+}
+
+static bool storm_rules_add(wchar_t const* name, wchar_t const* path, bool allow) {
+	(void)name;
+	(void)path;
+	(void)allow;
+
+	return false;
+}
+
+static enum NOTIFIER_ACTION storm_notify(wchar_t const* path) {
+	(void)path;
+
+	return NOTIFIER_ACTION_SKIP;
+}
+
+/**
+ * Converts a set of generated DOS paths into device paths in place.
+ */
+static bool to_device_paths(struct bench_paths* paths) {
+	wchar_t dev_path[BENCH_PATH_SIZE + 32];
+
+	for (size_t i = 0; i < paths->count; ++i) {
+		bench_devpath(dev_path, BENCH_PATH_SIZE + 32, paths->items[i]);
+
+		size_t count = wstr_len(dev_path, BENCH_PATH_SIZE + 32) + 1;
+		wchar_t* item = realloc(paths->items[i], sizeof(*item) * count);
+		if (item == NULL) {
+			return false;
+		}
+
+		wstr_copy(item, count, dev_path);
+		paths->items[i] = item;
+	}
+
+	return true;
+}
+
+/**
+ * Calls the drop callback as fast as possible, timing every call.
+ */
+static void storm_thread(void* arg) {
+	struct worker* w = arg;
+	uint64_t rng = g.opt.seed + w->index * 0x9E3779B97F4A7C15ULL;
+	wchar_t unique[BENCH_PATH_SIZE];
+	wchar_t dev_path[BENCH_PATH_SIZE + 32];
+
+	platform_atomic_add(&g.ready, 1);
+	while (platform_atomic_load(&g.go) == 0) {
+	}
+
+	for (size_t i = 0; i < g.opt.events; ++i) {
+		double pick = (double)(bench_rand(&rng) >> 11) / 9007199254740992.0;
+		wchar_t const* path;
+
+		if (pick < g.opt.hit_ratio && g.hits.count > 0) {
+			path = g.hits.items[bench_rand(&rng) % g.hits.count];
+		} else if (g.misses.count > 0) {
+			path = g.misses.items[bench_rand(&rng) % g.misses.count];
+		} else {
+			int64_t n = platform_atomic_add(&g.unique, 1);
+			swprintf(unique, BENCH_PATH_SIZE, L"c:\\users\\user\\appdata\\local\\temp\\%lld\\setup.exe", (long long)(UNIQUE_INDEX_BASE + n));
+			bench_devpath(dev_path, BENCH_PATH_SIZE + 32, unique);
+			path = dev_path;
+		}
+
+		int64_t start = platform_time_ns();
+		engine_drop_event(path);
+		w->samples[i] = platform_time_ns() - start;
+	}
+}
+
+/**
+ * Drains the notification queue like the notifier thread does.
+ */
+static void notifier_thread(void* arg) {
+	(void)arg;
+
+	while (engine_notify(true)) {
+	}
+}
+
+/**
+ * Periodically invalidates the cache, forcing a rebuild by the refresher.
+ */
+static void invalidate_thread(void* arg) {
+	(void)arg;
+
+	while (platform_atomic_load(&g.done) == 0) {
+		platform_sleep(g.opt.invalidate_ms);
+		engine_invalidate();
+	}
+}
+
+static void usage(void) {
+	fprintf(stderr,
+		"usage: notifier_storm [options]\n"
+		"  Calls the drop event callback from many threads at once and reports\n"
+		"  the time spent inside the callback. Results are written to stdout\n"
+		"  as one JSON object.\n"
+		"\n"
+		"  --threads N         concurrent callback threads (default 4)\n"
+		"  --events N          events per thread (default 200000)\n"
+		"  --rules N           number of synthetic firewall rules (default 2000)\n"
+		"  --hit-ratio R       fraction of events for known rules (default 0.95)\n"
+		"  --cardinality N     distinct unknown paths, 0 for always unique (default 10000)\n"
+		"  --invalidate-ms N   invalidate the cache every N ms, 0 for never (default 0)\n"
+		"  --dist NAME         path distribution: short, mixed, deep (default mixed)\n"
+		"  --keys MODE         key the cache by path, or by file identity (default path)\n"
+		"  --seed N            event generator seed (default 1)\n");
+}
+
+static bool parse_options(int argc, char** argv) {
+	g.opt.threads = 4;
+	g.opt.events = 200000;
+	g.opt.rules = 2000;
+	g.opt.cardinality = 10000;
+	g.opt.hit_ratio = 0.95;
+	g.opt.dist = BENCH_DIST_MIXED;
+	g.opt.seed = 1;
+
+	for (int i = 1; i < argc; ++i) {
+		char const* arg = argv[i];
+		char const* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (value == NULL) {
+			return false;
+		}
+
+		if (strcmp(arg, "--threads") == 0) {
+			g.opt.threads = (size_t)strtoull(value, NULL, 10);
+		} else if (strcmp(arg, "--events") == 0) {
+			g.opt.events = (size_t)strtoull(value, NULL, 10);
+		} else if (strcmp(arg, "--rules") == 0) {
+			g.opt.rules = (size_t)strtoull(value, NULL, 10);
+		} else if (strcmp(arg, "--cardinality") == 0) {
+			g.opt.cardinality = (size_t)strtoull(value, NULL, 10);
+		} else if (strcmp(arg, "--hit-ratio") == 0) {
+			g.opt.hit_ratio = atof(value);
+		} else if (strcmp(arg, "--invalidate-ms") == 0) {
+			g.opt.invalidate_ms = strtoll(value, NULL, 10);
+		} else if (strcmp(arg, "--seed") == 0) {
+			g.opt.seed = strtoull(value, NULL, 10);
+		} else if (strcmp(arg, "--keys") == 0) {
+			if (strcmp(value, "path") == 0) {
+				g.opt.file_ids = false;
+			} else if (strcmp(value, "identity") == 0) {
+				g.opt.file_ids = true;
+			} else {
+				return false;
+			}
+		} else if (strcmp(arg, "--dist") == 0) {
+			g.opt.dist = BENCH_DIST_COUNT;
+			for (int d = 0; d < BENCH_DIST_COUNT; ++d) {
+				if (strcmp(value, bench_dist_name((enum BENCH_DIST)d)) == 0) {
+					g.opt.dist = (enum BENCH_DIST)d;
+				}
+			}
+
+			if (g.opt.dist == BENCH_DIST_COUNT) {
+				return false;
+			}
+		} else {
+			return false;
+		}
+
+		++i;
+	}
+
+	return g.opt.threads > 0 && g.opt.threads <= MAX_THREADS && g.opt.events > 0 && g.opt.invalidate_ms >= 0;
+}
+
+int main(int argc, char** argv) {
+	if (parse_options(argc, argv) == false) {
+		usage();
+		return 1;
+	}
+
+	/* Known paths are the rules themselves, unknown ones come from a separate pool. */
+	if (bench_paths_create(&g.hits, g.opt.dist, RULE_SEED, 0, g.opt.rules) == false ||
+		bench_paths_create(&g.misses, g.opt.dist, APP_SEED, APP_INDEX_BASE, g.opt.cardinality) == false) {
+		return 1;
+	}
+
+	if (to_device_paths(&g.hits) == false || to_device_paths(&g.misses) == false) {
+		return 1;
+	}
+
+	struct engine_hooks hooks = {0};
+	hooks.time = platform_time;
+	hooks.dospath = devpath_normalize;
+	hooks.rules_enum = storm_rules_enum;
+	hooks.rules_add = storm_rules_add;
+	hooks.notify = storm_notify;
+
+	struct path_resolvers resolvers = BENCH_PATH_RESOLVERS;
+	if (g.opt.file_ids) {
+		resolvers.file_id = bench_file_id;
+	}
+
+	path_create(&resolvers);
+	engine_create(&hooks);
+	engine_rebuild();
+	engine_start();
+
+	platform_thread_t notifier;
+	platform_thread_t invalidator;
+	bool notifier_started = platform_thread_create(&notifier, notifier_thread, NULL);
+	bool invalidator_started = g.opt.invalidate_ms > 0 && platform_thread_create(&invalidator, invalidate_thread, NULL);
+
+	size_t total = g.opt.threads * g.opt.events;
+	int64_t* samples = malloc(sizeof(*samples) * total);
+	if (samples == NULL) {
+		return 1;
+	}
+
+	size_t started = 0;
+	for (size_t i = 0; i < g.opt.threads; ++i) {
+		struct worker* w = &g.workers[i];
+		w->index = i;
+		w->samples = samples + i * g.opt.events;
+
+		if (platform_thread_create(&w->thread, storm_thread, w) == false) {
+			break;
+		}
+
+		started += 1;
+	}
+
+	while (platform_atomic_load(&g.ready) < (int64_t)started) {
+	}
+
+	int64_t start = platform_time_ns();
+	platform_atomic_add(&g.go, 1);
+
+	for (size_t i = 0; i < started; ++i) {
+		platform_thread_join(&g.workers[i].thread);
+	}
+
+	int64_t elapsed = platform_time_ns() - start;
+	platform_atomic_add(&g.done, 1);
+
+	if (invalidator_started) {
+		platform_thread_join(&invalidator);
+	}
+
+	engine_close();
+
+	if (notifier_started) {
+		platform_thread_join(&notifier);
+	}
+
+	struct engine_stats stats;
+	engine_get_stats(&stats);
+
+	size_t count = started * g.opt.events;
+	double seconds = (double)elapsed / 1e9;
+
+	bench_report_begin("storm");
+	bench_report_int("threads", (int64_t)started);
+	bench_report_str("keys", g.opt.file_ids ? "identity" : "path");
+	bench_report_int("events", (int64_t)count);
+	bench_report_float("wall_seconds", seconds);
+	bench_report_float("events_per_sec", seconds > 0.0 ? (double)count / seconds : 0.0);
+	bench_report_int("p50_ns", bench_percentile(samples, count, 50.0));
+	bench_report_int("p99_ns", bench_percentile(samples, count, 99.0));
+	bench_report_int("p999_ns", bench_percentile(samples, count, 99.9));
+	bench_report_int("max_ns", count ? samples[count - 1] : 0);
+	bench_report_int("cache_hits", stats.cache_hits);
+	bench_report_int("cache_misses", stats.cache_misses);
+	bench_report_int("queue_drops", stats.queue_drops);
+	bench_report_int("rebuilds", stats.rebuilds);
+	bench_report_int("evictions", stats.evictions);
+	bench_report_int("runtime_entries", stats.runtime_entries);
+	bench_report_int("runtime_bytes", stats.runtime_bytes);
+	bench_report_int("notifications", stats.notifications);
+	bench_report_end();
+
+	engine_destroy();
+	path_destroy();
+
+	free(samples);
+	bench_paths_destroy(&g.misses);
+	bench_paths_destroy(&g.hits);
+
+	return 0;
+}
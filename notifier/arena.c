@@ -0,0 +1,145 @@
+#include "arena.h"
+#include "memory.h"
+#include <string.h>
+
+/**
+ * The size of a regular arena chunk, in bytes.
+ */
+#define ARENA_CHUNK_SIZE 65536
+
+/**
+ * Allocations larger than this get a dedicated chunk.
+ */
+#define ARENA_LARGE_SIZE (ARENA_CHUNK_SIZE / 4)
+
+/**
+ * Arena chunk header, followed by the chunk data.
+ */
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+};
+
+/**
+ * Returns the data following a chunk header.
+ */
+static uint8_t* chunk_data(struct arena_chunk *chunk) {
+	return (uint8_t*)(chunk + 1);
+}
+
+/**
+ * Allocates a chunk with room for size bytes.
+ */
+static struct arena_chunk* chunk_create(enum MEMORY_TAG tag, size_t size) {
+	struct arena_chunk *chunk = memory_alloc_raw(tag, sizeof(*chunk) + size);
+	if (chunk) {
+		chunk->next = NULL;
+		chunk->size = size;
+	}
+
+	return chunk;
+}
+
+void* arena_alloc(struct arena *arena, size_t bytes) {
+	if (arena == NULL || bytes == 0 || bytes > SIZE_MAX / 2) {
+		return NULL;
+	}
+
+	bytes = (bytes + 7) & ~(size_t)7;
+
+	/* Large allocations go in their own chunk, behind the current one. */
+	if (bytes > ARENA_LARGE_SIZE) {
+		struct arena_chunk *chunk = chunk_create(arena->tag, bytes);
+		if (chunk == NULL) {
+			return NULL;
+		}
+
+		if (arena->head) {
+			chunk->next = arena->head->next;
+			arena->head->next = chunk;
+		} else {
+			arena->head = chunk;
+			arena->used = bytes;
+		}
+
+		arena->bytes += bytes;
+		arena->chunks += 1;
+
+		return chunk_data(chunk);
+	}
+
+	if (arena->head == NULL || arena->used + bytes > arena->head->size) {
+		struct arena_chunk *chunk = chunk_create(arena->tag, ARENA_CHUNK_SIZE);
+		if (chunk == NULL) {
+			return NULL;
+		}
+
+		chunk->next = arena->head;
+		arena->head = chunk;
+		arena->used = 0;
+		arena->chunks += 1;
+	}
+
+	void *ptr = chunk_data(arena->head) + arena->used;
+	arena->used += bytes;
+	arena->bytes += bytes;
+
+	return ptr;
+}
+
+wchar_t* arena_wstr(struct arena *arena, wchar_t const *str, size_t len) {
+	if (str == NULL) {
+		return NULL;
+	}
+
+	wchar_t *copy = arena_alloc(arena, sizeof(*copy) * (len + 1));
+	if (copy) {
+		memcpy(copy, str, sizeof(*copy) * len);
+		copy[len] = 0;
+	}
+
+	return copy;
+}
+
+void arena_reset(struct arena *arena) {
+	if (arena == NULL || arena->head == NULL) {
+		return;
+	}
+
+	/* Keep a regular chunk around, the arena is usually refilled right away. */
+	struct arena_chunk *keep = NULL;
+	struct arena_chunk *chunk = arena->head;
+
+	while (chunk) {
+		struct arena_chunk *next = chunk->next;
+
+		if (keep == NULL && chunk->size == ARENA_CHUNK_SIZE) {
+			keep = chunk;
+		} else {
+			memory_free(chunk);
+		}
+
+		chunk = next;
+	}
+
+	if (keep) {
+		keep->next = NULL;
+	}
+
+	arena->head = keep;
+	arena->used = 0;
+	arena->bytes = 0;
+	arena->chunks = keep ? 1 : 0;
+}
+
+void arena_destroy(struct arena *arena) {
+	if (arena == NULL) {
+		return;
+	}
+
+	arena_reset(arena);
+	memory_free(arena->head);
+
+	arena->head = NULL;
+	arena->chunks = 0;
+}
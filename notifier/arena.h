@@ -0,0 +1,40 @@
+#pragma once
+#include "memory.h"
+#include "types.h"
+
+/**
+ * A chunked bump allocator. Allocations cannot be freed individually, the
+ * whole arena is released at once, making it suited to data rebuilt wholesale.
+ * Chunks are accounted to the arena's memory tag.
+ */
+struct arena {
+	enum MEMORY_TAG tag;
+	struct arena_chunk *head;
+	size_t used;
+	size_t bytes;
+	size_t chunks;
+};
+
+/**
+ * Allocates a region of memory with the size given in bytes from the arena,
+ * aligned to 8 bytes. The contents are not initialized.
+ * Returns a pointer to the allocated region on success, NULL otherwise.
+ */
+void* arena_alloc(struct arena *arena, size_t bytes);
+
+/**
+ * Returns a copy of a string of the given length allocated from the arena,
+ * NULL on failure.
+ */
+wchar_t* arena_wstr(struct arena *arena, wchar_t const *str, size_t len);
+
+/**
+ * Releases every allocation made from the arena. The first chunk is kept
+ * for reuse.
+ */
+void arena_reset(struct arena *arena);
+
+/**
+ * Releases every allocation and all memory held by the arena.
+ */
+void arena_destroy(struct arena *arena);
@@ -1,122 +1,1287 @@
 #include "cache.h"
+#include "arena.h"
 #include "config.h"
+#include "frozen.h"
 #include "memory.h"
+#include "platform.h"
 #include "wstr.h"
-#include <stdlib.h>
-#include <wchar.h>
+#include <string.h>
 
 /**
- * The number of buckets in the block cache hash table.
+ * The initial number of slots in a hash table, a power of two.
  */
-#define BLOCK_CACHE_SIZE 2053
+#define CACHE_MIN_CAPACITY 64
 
- /**
-  * Linked list node, for chained buckets.
-  */
-struct node {
+/**
+ * The table grows once more than 7/8 of its slots are in use.
+ */
+#define CACHE_LOAD_NUM 7
+#define CACHE_LOAD_DEN 8
+
+/**
+ * Arena storage is compacted once removed paths take up more than half of
+ * it and at least this many bytes.
+ */
+#define CACHE_COMPACT_BYTES 65536
+
+/**
+ * Budget of each runtime shard, the cache wide budget split evenly.
+ */
+#define CACHE_SHARD_ENTRIES (CACHE_MAX_ENTRIES / CACHE_SHARDS > 0 ? CACHE_MAX_ENTRIES / CACHE_SHARDS : 1)
+#define CACHE_SHARD_BYTES (CACHE_MAX_BYTES / CACHE_SHARDS)
+
+/**
+ * Rule changes since a snapshot was frozen are kept in its side table. The
+ * index is frozen again once they exceed an eighth of it plus this many.
+ */
+#define CACHE_FREEZE_SLACK 256
+
+/**
+ * Number of expiry records a prune works through per lock hold, so lookups
+ * racing with a large expiry only ever wait for a small slice of it.
+ */
+#define CACHE_PRUNE_SLICE 256
+
+/**
+ * Number of independently locked shards the runtime entries are split over,
+ * a power of two.
+ */
+#define CACHE_SHARDS 16
+
+/**
+ * Number of reader counters per epoch, a power of two. Readers are spread
+ * over them by thread so lookups do not contend on a single counter.
+ */
+#define CACHE_READER_STRIPES 16
+
+/**
+ * Hash value marking an empty slot. Path hashes never take this value.
+ */
+#define EMPTY_HASH 0
+
+/**
+ * Slot arrays of a hash table, allocated as a single block so readers see
+ * the arrays and their capacity change together. Lookups mark the runtime
+ * entries they hit as referenced, which spares them from the next eviction.
+ * The arrays readers look at without the lock are written with relaxed
+ * stores, and the referenced marks are only ever accessed that way.
+ */
+struct slots {
+	size_t capacity;
+	unsigned shift;
+	uint64_t volatile *hashes;
+	int64_t *times;
+	wchar_t const *volatile *paths;
+	uint32_t volatile *lengths;
+	uint8_t volatile *referenced;
+};
+
+/**
+ * The outcome of inserting a path.
+ */
+enum CACHE_INSERT {
+	CACHE_INSERT_FAILED,
+	CACHE_INSERT_KEPT,
+	CACHE_INSERT_REFRESHED,
+	CACHE_INSERT_ADDED
+};
+
+/**
+ * Notes the time an entry was added or refreshed.
+ */
+struct expiry_record {
+	uint64_t hash;
 	int64_t time;
-	wchar_t *path;
-	struct node *next;
 };
 
+/**
+ * Ring buffer of expiry records in the order entries were added or
+ * refreshed, so the oldest entries are always at the head. A refreshed entry
+ * leaves its earlier record behind, which is skipped once it reaches the
+ * head. Expiring entries thus only touches the records that are due.
+ */
+struct expiry {
+	struct expiry_record *records;
+	size_t capacity;
+	size_t head;
+	size_t count;
+};
+
+/**
+ * Open addressing (Robin Hood) hash table. Slot data is kept in separate
+ * arrays so a probe only walks the hashes, and the path is only compared
+ * once the full 64-bit hashes are equal. The paths themselves are interned
+ * in an arena which is released wholesale when the table is cleared.
+ *
+ * Writers hold the lock. Readers take no lock, they probe between two reads
+ * of the sequence, which is odd while a writer moves entries around, and
+ * retry if it changed. Replaced slot arrays and arenas are only released
+ * once no reader can be using them.
+ */
+struct table {
+	int64_t volatile lock;
+	int64_t volatile sequence;
+	struct slots *slots;
+	size_t count;
+	struct arena strings;
+	size_t dead_bytes;
+	size_t live_bytes;
+	size_t hand;
+	int64_t evictions;
+	struct expiry expiry;
+	uint8_t padding[64];
+};
+
+/**
+ * Memory replaced by a writer, released once readers are done with it.
+ */
+struct garbage {
+	struct slots *slots;
+	struct arena strings;
+	struct frozen *frozen;
+};
+
+/**
+ * Rule paths, frozen into a perfect hash index when the snapshot is
+ * published. Rule deltas after that go to the side table, or mark frozen
+ * paths as removed, until there are enough of them to freeze again.
+ */
+struct cache_snapshot {
+	void* volatile frozen;
+	size_t removed;
+	size_t freeze_at;
+	struct table table;
+};
+
+/**
+ * Reader counters of one stripe, for both epoch parities.
+ */
+struct readers {
+	int64_t volatile count[2];
+	uint8_t padding[48];
+};
+
+/**
+ * The cache is made of the published rule snapshot and the paths added at
+ * runtime, sharded by hash. Lookups take no locks.
+ *
+ * Readers announce themselves in a counter of the current epoch. Memory a
+ * reader may still see is released by advancing the epoch and waiting for
+ * the counters of the previous one to drain.
+ */
 static struct {
-	struct node *table[BLOCK_CACHE_SIZE];
+	struct table runtime[CACHE_SHARDS];
+	void* volatile snapshot;
+	int64_t volatile epoch;
+	int64_t volatile sync_lock;
+	struct readers readers[CACHE_READER_STRIPES];
 } g;
 
-static struct node* cache_find(struct node* n, wchar_t const* path) {
-	while (n) {
-		if (wcscmp(path, n->path) == 0) {
-			return n;
+/**
+ * Returns the hash of a path, never EMPTY_HASH.
+ */
+static uint64_t cache_hash(wchar_t const *path, size_t len) {
+	uint64_t hash = wstr_hash_len(path, len);
+	return hash == EMPTY_HASH ? 1 : hash;
+}
+
+/**
+ * Returns the hash of a key as cache_hash would compute it.
+ */
+static uint64_t cache_key_hash(struct cache_key const *key) {
+	return key->hash == EMPTY_HASH ? 1 : key->hash;
+}
+
+/**
+ * Acquires a spin lock. Held only briefly, so spinning beats sleeping.
+ */
+static void spin_lock(int64_t volatile *lock) {
+	for (unsigned spins = 0; platform_atomic_cas(lock, 0, 1) != 0; ++spins) {
+		if (spins >= 64) {
+			platform_sleep(0);
+		}
+	}
+}
+
+static void spin_unlock(int64_t volatile *lock) {
+	platform_atomic_cas(lock, 1, 0);
+}
+
+/**
+ * Registers the calling thread as a reader in a stripe.
+ * Returns the epoch to pass to reader_leave.
+ */
+static int64_t reader_enter(size_t stripe) {
+	struct readers *r = &g.readers[stripe];
+
+	for (;;) {
+		int64_t epoch = platform_atomic_load(&g.epoch);
+		platform_atomic_add(&r->count[epoch & 1], 1);
+
+		/* A writer may have advanced the epoch before the counter was
+		 * raised and missed this reader, announce again in the new one. */
+		if (platform_atomic_load(&g.epoch) == epoch) {
+			return epoch;
 		}
 
-		n = n->next;
+		platform_atomic_add(&r->count[epoch & 1], -1);
 	}
+}
 
-	return NULL;
+/**
+ * Unregisters a reader.
+ */
+static void reader_leave(size_t stripe, int64_t epoch) {
+	platform_atomic_add(&g.readers[stripe].count[epoch & 1], -1);
 }
 
-void cache_clear(void) {
-	for (size_t i = 0; i < BLOCK_CACHE_SIZE; ++i) {
-		struct node *n = g.table[i];
-		while (n) {
-			struct node *temp = n->next;
+/**
+ * Waits until every reader that started before the call is done.
+ */
+static void cache_synchronize(void) {
+	spin_lock(&g.sync_lock);
 
-			free(n->path);
-			free(n);
+	/* Readers arriving from here on use the other counters. */
+	int64_t epoch = platform_atomic_add(&g.epoch, 1) - 1;
 
-			n = temp;
+	for (size_t i = 0; i < CACHE_READER_STRIPES; ++i) {
+		for (unsigned spins = 0; platform_atomic_load(&g.readers[i].count[epoch & 1]) != 0; ++spins) {
+			platform_sleep(spins < 64 ? 0 : 1);
 		}
+	}
+
+	spin_unlock(&g.sync_lock);
+}
+
+/**
+ * Releases replaced memory right away, for memory no reader can see.
+ */
+static void garbage_free(struct garbage *garbage) {
+	memory_free(garbage->slots);
+	arena_destroy(&garbage->strings);
+	frozen_destroy(garbage->frozen);
+
+	garbage->slots = NULL;
+	garbage->frozen = NULL;
+}
 
-		g.table[i] = NULL;
+/**
+ * Releases replaced memory once no reader can be using it.
+ */
+static void garbage_release(struct garbage *garbage) {
+	if (garbage->slots == NULL && garbage->strings.head == NULL && garbage->frozen == NULL) {
+		return;
 	}
+
+	cache_synchronize();
+	garbage_free(garbage);
 }
 
-bool cache_contains(wchar_t const *path) {
+/**
+ * Marks the start of a change readers must not observe halfway.
+ */
+static void write_begin(struct table *t) {
+	platform_atomic_add(&t->sequence, 1);
+}
+
+static void write_end(struct table *t) {
+	platform_atomic_add(&t->sequence, 1);
+}
+
+/**
+ * Returns the slot arrays of a table, for readers holding no lock.
+ */
+static struct slots const* table_slots(struct table const *t) {
+	return platform_atomic_load_ptr((void* volatile const*)&t->slots);
+}
+
+/**
+ * Returns the preferred slot of a hash (Fibonacci hashing of the high bits).
+ */
+static size_t table_home(struct slots const *s, uint64_t hash) {
+	return (size_t)((hash * 0x9E3779B97F4A7C15ULL) >> s->shift);
+}
+
+/**
+ * Returns how far the entry in a slot is from its preferred slot.
+ */
+static size_t table_distance(struct slots const *s, size_t slot) {
+	return (slot - table_home(s, PLATFORM_RELAXED_LOAD(&s->hashes[slot]))) & (s->capacity - 1);
+}
+
+/**
+ * Returns the slot holding the path, or capacity if it is not present.
+ * Readers holding no lock pass the sequence they started at, if a writer
+ * got in before a path is compared SIZE_MAX is returned to have them retry.
+ */
+static size_t table_find(struct slots const *s, uint64_t hash, wchar_t const *path, size_t len, int64_t volatile const *sequence, int64_t start) {
+	size_t mask = s->capacity - 1;
+	size_t slot = table_home(s, hash);
+
+	/* Bounded, a concurrent writer may leave the probe without an end. */
+	for (size_t dist = 0; dist < s->capacity; ++dist) {
+		uint64_t h = PLATFORM_RELAXED_LOAD(&s->hashes[slot]);
+
+		/* Robin Hood invariant: the path would have displaced a closer entry. */
+		if (h == EMPTY_HASH || table_distance(s, slot) < dist) {
+			return s->capacity;
+		}
+
+		if (h == hash && PLATFORM_RELAXED_LOAD(&s->lengths[slot]) == len) {
+			wchar_t const *p = PLATFORM_RELAXED_LOAD(&s->paths[slot]);
+
+			/* The path and length must belong to the same entry before the
+			 * path is read. The string itself outlives the reader. */
+			if (sequence) {
+				platform_atomic_fence();
+				if (platform_atomic_load(sequence) != start) {
+					return SIZE_MAX;
+				}
+			}
+
+			if (memcmp(p, path, sizeof(*path) * len) == 0) {
+				return slot;
+			}
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	return s->capacity;
+}
+
+/**
+ * Returns true if the table holds the path, marking it as referenced if
+ * asked to. Takes no lock, the caller is registered as a reader.
+ */
+static bool table_contains(struct table const *t, uint64_t hash, wchar_t const *path, size_t len, bool mark) {
+	for (unsigned spins = 0;; ++spins) {
+		int64_t start = platform_atomic_load(&t->sequence);
+
+		if ((start & 1) == 0) {
+			struct slots const *s = table_slots(t);
+			size_t slot = s ? table_find(s, hash, path, len, &t->sequence, start) : 0;
+
+			platform_atomic_fence();
+			if (slot != SIZE_MAX && platform_atomic_load(&t->sequence) == start) {
+				bool found = s && slot != s->capacity;
+
+				/* A writer may have moved another entry into the slot since,
+				 * which then merely gets a second chance it did not earn. The
+				 * slot arrays outlive the reader. Marked entries are left
+				 * alone, so hot lines stay shared. */
+				if (found && mark && PLATFORM_RELAXED_LOAD(&s->referenced[slot]) == 0) {
+					PLATFORM_RELAXED_STORE(&s->referenced[slot], 1);
+				}
+
+				return found;
+			}
+		}
+
+		if (spins >= 64) {
+			platform_sleep(0);
+		}
+	}
+}
+
+/**
+ * Fills a slot. Requires the lock to be held, readers may be looking.
+ */
+static void slot_set(struct slots *s, size_t slot, uint64_t hash, wchar_t const *path, uint32_t len, int64_t time, uint8_t referenced) {
+	PLATFORM_RELAXED_STORE(&s->hashes[slot], hash);
+	PLATFORM_RELAXED_STORE(&s->paths[slot], path);
+	PLATFORM_RELAXED_STORE(&s->lengths[slot], len);
+	PLATFORM_RELAXED_STORE(&s->referenced[slot], referenced);
+	s->times[slot] = time;
+}
+
+/**
+ * Places an entry known to be absent, displacing entries closer to their
+ * preferred slot. Requires a free slot.
+ */
+static void table_place(struct slots *s, uint64_t hash, wchar_t const *path, uint32_t len, int64_t time, uint8_t referenced) {
+	size_t mask = s->capacity - 1;
+	size_t slot = table_home(s, hash);
+	size_t dist = 0;
+
+	for (;;) {
+		if (s->hashes[slot] == EMPTY_HASH) {
+			slot_set(s, slot, hash, path, len, time, referenced);
+			return;
+		}
+
+		size_t existing = table_distance(s, slot);
+		if (existing < dist) {
+			uint64_t h = s->hashes[slot];
+			wchar_t const *p = s->paths[slot];
+			uint32_t l = s->lengths[slot];
+			int64_t tm = s->times[slot];
+			uint8_t r = PLATFORM_RELAXED_LOAD(&s->referenced[slot]);
+
+			slot_set(s, slot, hash, path, len, time, referenced);
+
+			hash = h;
+			path = p;
+			len = l;
+			time = tm;
+			referenced = r;
+			dist = existing;
+		}
+
+		slot = (slot + 1) & mask;
+		dist += 1;
+	}
+}
+
+/**
+ * Removes the entry in a slot, shifting the following entries back.
+ * Requires the lock to be held.
+ */
+static void table_remove(struct table *t, size_t slot) {
+	struct slots *s = t->slots;
+	size_t mask = s->capacity - 1;
+
+	/* The path stays in the arena until the next compaction or clear. */
+	size_t bytes = sizeof(wchar_t) * ((size_t)s->lengths[slot] + 1);
+	t->dead_bytes += bytes;
+	t->live_bytes -= bytes;
+
+	write_begin(t);
+
+	for (;;) {
+		size_t next = (slot + 1) & mask;
+
+		if (s->hashes[next] == EMPTY_HASH || table_distance(s, next) == 0) {
+			break;
+		}
+
+		slot_set(s, slot, s->hashes[next], s->paths[next], s->lengths[next], s->times[next], PLATFORM_RELAXED_LOAD(&s->referenced[next]));
+		slot = next;
+	}
+
+	slot_set(s, slot, EMPTY_HASH, NULL, 0, 0, 0);
+
+	write_end(t);
+
+	t->count -= 1;
+}
+
+/**
+ * Allocates slot arrays of the given power of two capacity, all empty.
+ */
+static struct slots* slots_create(size_t capacity) {
+	size_t bytes = sizeof(struct slots) + capacity * (sizeof(uint64_t) + sizeof(int64_t) + sizeof(wchar_t const*) + sizeof(uint32_t) + sizeof(uint8_t));
+
+	struct slots *s = memory_alloc_raw(MEMORY_TAG_CACHE, bytes);
+	if (s == NULL) {
+		return NULL;
+	}
+
+	unsigned bits = 0;
+	while (((size_t)1 << bits) < capacity) {
+		++bits;
+	}
+
+	s->capacity = capacity;
+	s->shift = 64 - bits;
+	s->hashes = (uint64_t*)(s + 1);
+	s->times = (int64_t*)(s->hashes + capacity);
+	s->paths = (wchar_t const**)(s->times + capacity);
+	s->lengths = (uint32_t*)(s->paths + capacity);
+	s->referenced = (uint8_t*)(s->lengths + capacity);
+
+	/* Only the hashes need clearing, they mark which slots are in use. No
+	 * reader sees the arrays before they are published. */
+	memset((void*)s->hashes, 0, sizeof(*s->hashes) * capacity);
+
+	return s;
+}
+
+/**
+ * Resizes the table to the given power of two capacity, rehashing every
+ * entry into new slot arrays. Readers keep using the old ones, which are
+ * handed to the garbage. Requires the lock to be held.
+ */
+static bool table_resize(struct table *t, size_t capacity, struct garbage *garbage) {
+	struct slots *s = slots_create(capacity);
+	if (s == NULL) {
+		return false;
+	}
+
+	struct slots *old = t->slots;
+	if (old) {
+		for (size_t i = 0; i < old->capacity; ++i) {
+			if (old->hashes[i] != EMPTY_HASH) {
+				table_place(s, old->hashes[i], old->paths[i], old->lengths[i], old->times[i], PLATFORM_RELAXED_LOAD(&old->referenced[i]));
+			}
+		}
+	}
+
+	platform_atomic_swap_ptr((void* volatile*)&t->slots, s);
+	garbage->slots = old;
+
+	return true;
+}
+
+/**
+ * Moves the remaining paths into a fresh arena. The old arena is handed to
+ * the garbage. Requires the lock to be held.
+ */
+static void table_compact(struct table *t, struct garbage *garbage) {
+	struct slots *s = t->slots;
+	struct arena strings = {0};
+	strings.tag = MEMORY_TAG_CACHE;
+
+	/* Copy first, so a failure leaves the table untouched. */
+	wchar_t const **copies = memory_alloc_raw(MEMORY_TAG_CACHE, sizeof(*copies) * s->capacity);
+	if (copies == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < s->capacity; ++i) {
+		if (s->hashes[i] != EMPTY_HASH) {
+			copies[i] = arena_wstr(&strings, s->paths[i], s->lengths[i]);
+			if (copies[i] == NULL) {
+				arena_destroy(&strings);
+				memory_free((void*)copies);
+				return;
+			}
+		}
+	}
+
+	write_begin(t);
+
+	for (size_t i = 0; i < s->capacity; ++i) {
+		if (s->hashes[i] != EMPTY_HASH) {
+			PLATFORM_RELAXED_STORE(&s->paths[i], copies[i]);
+		}
+	}
+
+	write_end(t);
+
+	memory_free((void*)copies);
+
+	garbage->strings = t->strings;
+	t->strings = strings;
+	t->dead_bytes = 0;
+}
+
+/**
+ * Removes every entry, handing the slot arrays and arena to the garbage.
+ * Requires the lock to be held.
+ */
+static void table_clear(struct table *t, struct garbage *garbage) {
+	write_begin(t);
+	garbage->slots = platform_atomic_swap_ptr((void* volatile*)&t->slots, NULL);
+	write_end(t);
+
+	garbage->strings = t->strings;
+	memset(&t->strings, 0, sizeof(t->strings));
+
+	t->count = 0;
+	t->dead_bytes = 0;
+	t->live_bytes = 0;
+	t->hand = 0;
+
+	/* Only writers read the expiry records. */
+	memory_free(t->expiry.records);
+	memset(&t->expiry, 0, sizeof(t->expiry));
+}
+
+/**
+ * Inserts a path of a known length and hash, or refreshes its time if newer.
+ * Requires the lock to be held.
+ */
+static enum CACHE_INSERT table_insert(struct table *t, uint64_t hash, wchar_t const *path, size_t len, int64_t time, struct garbage *garbage) {
+	struct slots *s = t->slots;
+	size_t slot = s ? table_find(s, hash, path, len, NULL, 0) : 0;
+
+	if (s && slot != s->capacity) {
+		if (s->times[slot] < time) {
+			s->times[slot] = time;
+			return CACHE_INSERT_REFRESHED;
+		}
+
+		return CACHE_INSERT_KEPT;
+	}
+
+	/* Grow ahead of the insert to keep probe sequences short. */
+	size_t capacity = s ? s->capacity : 0;
+	if ((t->count + 1) * CACHE_LOAD_DEN > capacity * CACHE_LOAD_NUM) {
+		if (table_resize(t, capacity ? capacity * 2 : CACHE_MIN_CAPACITY, garbage) == false) {
+			return CACHE_INSERT_FAILED;
+		}
+	}
+
+	t->strings.tag = MEMORY_TAG_CACHE;
+
+	wchar_t const *copy = arena_wstr(&t->strings, path, len);
+	if (copy == NULL) {
+		return CACHE_INSERT_FAILED;
+	}
+
+	/* New entries start out referenced, so they survive at least one sweep. */
+	write_begin(t);
+	table_place(t->slots, hash, copy, (uint32_t)len, time, 1);
+	write_end(t);
+
+	t->count += 1;
+	t->live_bytes += sizeof(wchar_t) * (len + 1);
+
+	return CACHE_INSERT_ADDED;
+}
+
+/**
+ * Returns true if an entry with the given hash was last refreshed at the
+ * given time, that is the record of that time is the latest for it.
+ * Requires the lock to be held.
+ */
+static bool expiry_is_live(struct table const *t, struct expiry_record const *r) {
+	struct slots const *s = t->slots;
+	if (s == NULL) {
+		return false;
+	}
+
+	size_t mask = s->capacity - 1;
+	size_t slot = table_home(s, r->hash);
+
+	for (size_t dist = 0; dist < s->capacity; ++dist) {
+		uint64_t h = s->hashes[slot];
+		if (h == EMPTY_HASH || table_distance(s, slot) < dist) {
+			break;
+		}
+
+		if (h == r->hash && s->times[slot] == r->time) {
+			return true;
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	return false;
+}
+
+/**
+ * Doubles the capacity of the expiry buffer. Requires the lock to be held.
+ */
+static bool expiry_grow(struct expiry *e) {
+	size_t capacity = e->capacity ? e->capacity * 2 : CACHE_MIN_CAPACITY;
+
+	struct expiry_record *records = MEMORY_ALLOC_COUNT(MEMORY_TAG_CACHE, records, capacity);
+	if (records == NULL) {
+		return false;
+	}
+
+	for (size_t i = 0; i < e->count; ++i) {
+		records[i] = e->records[(e->head + i) & (e->capacity - 1)];
+	}
+
+	memory_free(e->records);
+	e->records = records;
+	e->capacity = capacity;
+	e->head = 0;
+
+	return true;
+}
+
+/**
+ * Appends an expiry record. A full buffer first drops the records left
+ * behind by refreshed or removed entries and only grows if that frees less
+ * than a quarter of it. Requires the lock to be held.
+ */
+static bool expiry_push(struct table *t, uint64_t hash, int64_t time) {
+	struct expiry *e = &t->expiry;
+
+	if (e->count == e->capacity) {
+		size_t mask = e->capacity - 1;
+		size_t kept = 0;
+
+		for (size_t i = 0; i < e->count; ++i) {
+			struct expiry_record r = e->records[(e->head + i) & mask];
+			if (expiry_is_live(t, &r)) {
+				e->records[(e->head + kept++) & mask] = r;
+			}
+		}
+
+		e->count = kept;
+
+		if (e->count * 4 >= e->capacity * 3 && expiry_grow(e) == false && e->count == e->capacity) {
+			return false;
+		}
+	}
+
+	struct expiry_record *r = &e->records[(e->head + e->count) & (e->capacity - 1)];
+	r->hash = hash;
+	r->time = time;
+	e->count += 1;
+
+	return true;
+}
+
+/**
+ * Removes the entries with the given hash last refreshed before the
+ * deadline. Returns the number removed. Requires the lock to be held.
+ */
+static size_t table_expire_hash(struct table *t, uint64_t hash, int64_t deadline) {
+	size_t removed = 0;
+
+	for (bool again = t->slots != NULL; again;) {
+		struct slots *s = t->slots;
+		size_t mask = s->capacity - 1;
+		size_t slot = table_home(s, hash);
+
+		again = false;
+
+		for (size_t dist = 0; dist < s->capacity; ++dist) {
+			uint64_t h = s->hashes[slot];
+			if (h == EMPTY_HASH || table_distance(s, slot) < dist) {
+				break;
+			}
+
+			/* Removal shifts the cluster, so probe again from the start. */
+			if (h == hash && s->times[slot] < deadline) {
+				table_remove(t, slot);
+				removed += 1;
+				again = true;
+				break;
+			}
+
+			slot = (slot + 1) & mask;
+		}
+	}
+
+	return removed;
+}
+
+/**
+ * Removes entries last refreshed before the deadline, working through at
+ * most budget expiry records. Sets more if due records remain.
+ * Returns the number of entries removed. Requires the lock to be held.
+ */
+static size_t table_expire(struct table *t, int64_t deadline, size_t budget, bool *more) {
+	struct expiry *e = &t->expiry;
+	size_t removed = 0;
+
+	*more = false;
+
+	while (e->count > 0 && e->records[e->head].time < deadline) {
+		if (budget-- == 0) {
+			*more = true;
+			break;
+		}
+
+		uint64_t hash = e->records[e->head].hash;
+		e->head = (e->head + 1) & (e->capacity - 1);
+		e->count -= 1;
+
+		removed += table_expire_hash(t, hash, deadline);
+	}
+
+	return removed;
+}
+
+/**
+ * Compacts the arena of a table if removed paths dominate it.
+ * Requires the lock to be held.
+ */
+static void table_maybe_compact(struct table *t, struct garbage *garbage) {
+	if (t->dead_bytes >= CACHE_COMPACT_BYTES && t->dead_bytes * 2 > t->strings.bytes) {
+		table_compact(t, garbage);
+	}
+}
+
+/**
+ * Removes a path from a table if present.
+ */
+static void table_erase(struct table *t, uint64_t hash, wchar_t const *path, size_t len) {
+	struct garbage garbage = {0};
+
+	spin_lock(&t->lock);
+
+	struct slots *s = t->slots;
+	size_t slot = s ? table_find(s, hash, path, len, NULL, 0) : 0;
+
+	if (s && slot != s->capacity) {
+		table_remove(t, slot);
+		table_maybe_compact(t, &garbage);
+	}
+
+	spin_unlock(&t->lock);
+
+	garbage_release(&garbage);
+}
+
+/**
+ * Returns the runtime shard a hash belongs to.
+ */
+static struct table* cache_shard(uint64_t hash) {
+	return &g.runtime[hash & (CACHE_SHARDS - 1)];
+}
+
+/**
+ * Returns the frozen index of a snapshot, NULL if there is none.
+ */
+static struct frozen* snapshot_frozen(struct cache_snapshot const *snapshot) {
+	return platform_atomic_load_ptr(&snapshot->frozen);
+}
+
+/**
+ * Returns true if a snapshot holds the path. Takes no lock, the caller is
+ * registered as a reader.
+ */
+static bool snapshot_contains(struct cache_snapshot const *snapshot, uint64_t hash, wchar_t const *path, size_t len) {
+	/* The side table goes first: freezing publishes the new index before it
+	 * empties the side table, so a path moving between them is never missed. */
+	if (table_contains(&snapshot->table, hash, path, len, false)) {
+		return true;
+	}
+
+	struct frozen const *f = snapshot_frozen(snapshot);
+	if (f == NULL) {
+		return false;
+	}
+
+	size_t slot = frozen_find(f, hash, path, len);
+	return slot != SIZE_MAX && frozen_removed(f, slot) == false;
+}
+
+/**
+ * Freezes the paths of a snapshot into a new index and empties the side
+ * table. The index and memory replaced go to the garbage. Only the
+ * publishing thread may freeze a published snapshot.
+ */
+static void snapshot_freeze(struct cache_snapshot *snapshot, struct garbage *garbage) {
+	struct frozen *f = snapshot_frozen(snapshot);
+	struct table *t = &snapshot->table;
+	size_t count = frozen_count(f) - snapshot->removed + t->count;
+
+	struct frozen_key *keys = MEMORY_ALLOC_COUNT(MEMORY_TAG_GENERAL, keys, count);
+	struct frozen *frozen = NULL;
+
+	if (keys) {
+		size_t n = 0;
+
+		for (size_t i = 0; i < frozen_count(f); ++i) {
+			if (frozen_removed(f, i) == false) {
+				frozen_key(f, i, &keys[n++]);
+			}
+		}
+
+		struct slots const *s = t->slots;
+		for (size_t i = 0; s && i < s->capacity; ++i) {
+			if (s->hashes[i] != EMPTY_HASH) {
+				keys[n].hash = s->hashes[i];
+				keys[n].path = s->paths[i];
+				keys[n].len = s->lengths[i];
+				++n;
+			}
+		}
+
+		frozen = frozen_build(keys, n);
+		memory_free(keys);
+	}
+
+	if (frozen == NULL) {
+		/* Everything stays in the side table, try again once it doubled. */
+		snapshot->freeze_at = 2 * (t->count + snapshot->removed) + CACHE_FREEZE_SLACK;
+		return;
+	}
+
+	garbage->frozen = platform_atomic_swap_ptr(&snapshot->frozen, frozen);
+	snapshot->removed = 0;
+	snapshot->freeze_at = count / 8 + CACHE_FREEZE_SLACK;
+
+	spin_lock(&t->lock);
+	table_clear(t, garbage);
+	spin_unlock(&t->lock);
+}
+
+/**
+ * Freezes a published snapshot again once enough rules changed.
+ */
+static void snapshot_maybe_freeze(struct cache_snapshot *snapshot) {
+	if (snapshot->table.count + snapshot->removed <= snapshot->freeze_at) {
+		return;
+	}
+
+	struct garbage garbage = {0};
+	snapshot_freeze(snapshot, &garbage);
+	garbage_release(&garbage);
+}
+
+/**
+ * Returns true if the published snapshot or the runtime entries hold the
+ * path. Takes no locks.
+ */
+static bool cache_lookup(uint64_t hash, wchar_t const *path, size_t len, bool runtime) {
+	size_t stripe = platform_thread_stripe(CACHE_READER_STRIPES);
+	int64_t epoch = reader_enter(stripe);
+
+	struct cache_snapshot const *snapshot = platform_atomic_load_ptr(&g.snapshot);
+	bool found = snapshot && snapshot_contains(snapshot, hash, path, len);
+
+	if (found == false && runtime) {
+		found = table_contains(cache_shard(hash), hash, path, len, true);
+	}
+
+	reader_leave(stripe, epoch);
+
+	return found;
+}
+
+/**
+ * Evicts entries until the table is within the budget of a runtime shard.
+ * The clock hand sweeps the slots, clearing the referenced mark of entries
+ * looked up since its last pass and evicting the first unmarked one.
+ * Requires the lock to be held.
+ */
+static void table_evict(struct table *t) {
+	while (t->count > 0 && (t->count > CACHE_SHARD_ENTRIES || t->live_bytes > CACHE_SHARD_BYTES)) {
+		struct slots *s = t->slots;
+		size_t mask = s->capacity - 1;
+
+		/* Two passes clear every mark, so an entry is always found. */
+		for (size_t steps = 0; steps < 2 * s->capacity; ++steps) {
+			size_t slot = t->hand;
+
+			if (s->hashes[slot] != EMPTY_HASH) {
+				if (PLATFORM_RELAXED_LOAD(&s->referenced[slot]) == 0) {
+					/* The following entry shifts into the slot, the hand stays. */
+					table_remove(t, slot);
+					t->evictions += 1;
+					break;
+				}
+
+				PLATFORM_RELAXED_STORE(&s->referenced[slot], 0);
+			}
+
+			t->hand = (slot + 1) & mask;
+		}
+	}
+}
+
+/**
+ * Adds or refreshes a runtime path and notes when it expires.
+ */
+static enum CACHE_INSERT runtime_insert(uint64_t hash, wchar_t const *path, size_t len, int64_t time) {
+	struct table *t = cache_shard(hash);
+	struct garbage garbage = {0};
+
+	spin_lock(&t->lock);
+
+	enum CACHE_INSERT result = table_insert(t, hash, path, len, time, &garbage);
+
+	if (result == CACHE_INSERT_ADDED || result == CACHE_INSERT_REFRESHED) {
+		/* An entry without a record would never expire, so it is dropped.
+		 * A refreshed one still has its earlier record. */
+		if (expiry_push(t, hash, time) == false && result == CACHE_INSERT_ADDED) {
+			table_remove(t, table_find(t->slots, hash, path, len, NULL, 0));
+			result = CACHE_INSERT_FAILED;
+		}
+	}
+
+	if (result == CACHE_INSERT_ADDED) {
+		table_evict(t);
+		table_maybe_compact(t, &garbage);
+	}
+
+	spin_unlock(&t->lock);
+
+	garbage_release(&garbage);
+
+	return result;
+}
+
+struct cache_snapshot* cache_snapshot_create(void) {
+	return memory_alloc(MEMORY_TAG_CACHE, sizeof(struct cache_snapshot));
+}
+
+bool cache_snapshot_insert(struct cache_snapshot *snapshot, wchar_t const *path) {
+	if (snapshot == NULL || path == NULL) {
+		return false;
+	}
+
+	size_t len = wstr_len(path, MAX_EXT_PATH);
+	if (len >= MAX_EXT_PATH) {
+		return false;
+	}
+
+	/* Nobody reads the snapshot until it is published, the slot arrays a
+	 * resize replaces can go right away. */
+	struct garbage garbage = {0};
+	enum CACHE_INSERT result = table_insert(&snapshot->table, cache_hash(path, len), path, len, 0, &garbage);
+	memory_free(garbage.slots);
+
+	return result != CACHE_INSERT_FAILED;
+}
+
+struct cache_snapshot* cache_snapshot_load(wchar_t const *path) {
 	if (path == NULL) {
+		return NULL;
+	}
+
+	struct frozen *frozen = frozen_load(path);
+	if (frozen == NULL) {
+		return NULL;
+	}
+
+	struct cache_snapshot *snapshot = cache_snapshot_create();
+	if (snapshot == NULL) {
+		frozen_destroy(frozen);
+		return NULL;
+	}
+
+	snapshot->frozen = frozen;
+	snapshot->freeze_at = frozen_count(frozen) / 8 + CACHE_FREEZE_SLACK;
+
+	return snapshot;
+}
+
+size_t cache_snapshot_count(struct cache_snapshot const *snapshot) {
+	if (snapshot == NULL) {
+		return 0;
+	}
+
+	return frozen_count(snapshot_frozen(snapshot)) - snapshot->removed + snapshot->table.count;
+}
+
+void cache_snapshot_destroy(struct cache_snapshot *snapshot) {
+	if (snapshot == NULL) {
+		return;
+	}
+
+	frozen_destroy(snapshot_frozen(snapshot));
+	memory_free(snapshot->table.slots);
+	arena_destroy(&snapshot->table.strings);
+	memory_free(snapshot);
+}
+
+void cache_publish(struct cache_snapshot *snapshot) {
+	/* Nobody reads the snapshot yet, what freezing replaces can go right away. */
+	if (snapshot && snapshot_frozen(snapshot) == NULL) {
+		struct garbage garbage = {0};
+		snapshot_freeze(snapshot, &garbage);
+		garbage_free(&garbage);
+	}
+
+	struct cache_snapshot *old = platform_atomic_swap_ptr(&g.snapshot, snapshot);
+
+	/* Readers arriving from here on see the new snapshot. */
+	cache_synchronize();
+	cache_snapshot_destroy(old);
+}
+
+bool cache_save(wchar_t const *path) {
+	struct cache_snapshot *snapshot = platform_atomic_load_ptr(&g.snapshot);
+	if (path == NULL || snapshot == NULL) {
+		return false;
+	}
+
+	/*
+	 * Only the frozen index is saved. Rule deltas stay in the side table until
+	 * snapshot_maybe_freeze folds them in, so the file changes once per freeze
+	 * rather than once per rule change. The first refresh after loading
+	 * rebuilds the snapshot from the rules anyway.
+	 */
+	struct frozen const *f = snapshot_frozen(snapshot);
+	if (f == NULL) {
 		return false;
 	}
 
-	size_t i = wstr_hash(path) % BLOCK_CACHE_SIZE;
-	return cache_find(g.table[i], path) != NULL;
+	return frozen_saved(f, path) || frozen_save(f, path);
 }
 
-bool cache_insert(wchar_t const *path, int64_t time) {
+bool cache_rule_add(wchar_t const *path) {
 	if (path == NULL) {
 		return false;
 	}
 
-	size_t i = wstr_hash(path) % BLOCK_CACHE_SIZE;
-	struct node* n = cache_find(g.table[i], path);
+	size_t len = wstr_len(path, MAX_EXT_PATH);
+	if (len >= MAX_EXT_PATH) {
+		return false;
+	}
 
-	if (n != NULL) {
-		if (n->time < time) {
-			n->time = time;
+	struct cache_snapshot *snapshot = platform_atomic_load_ptr(&g.snapshot);
+	if (snapshot == NULL) {
+		return false;
+	}
+
+	uint64_t hash = cache_hash(path, len);
+
+	/* A frozen path removed earlier only needs its mark cleared. */
+	struct frozen *f = snapshot_frozen(snapshot);
+	size_t slot = f ? frozen_find(f, hash, path, len) : SIZE_MAX;
+
+	if (slot != SIZE_MAX) {
+		if (frozen_removed(f, slot)) {
+			frozen_set_removed(f, slot, false);
+			snapshot->removed -= 1;
 		}
 
 		return true;
 	}
 
-	n = memory_alloc(sizeof(*n));
+	struct table *t = &snapshot->table;
+	struct garbage garbage = {0};
+
+	spin_lock(&t->lock);
+	enum CACHE_INSERT result = table_insert(t, hash, path, len, 0, &garbage);
+	spin_unlock(&t->lock);
+
+	garbage_release(&garbage);
+	snapshot_maybe_freeze(snapshot);
+
+	return result != CACHE_INSERT_FAILED;
+}
+
+void cache_rule_remove(wchar_t const *path) {
+	struct cache_snapshot *snapshot = platform_atomic_load_ptr(&g.snapshot);
+	if (path == NULL || snapshot == NULL) {
+		return;
+	}
+
+	size_t len = wstr_len(path, MAX_EXT_PATH);
+	uint64_t hash = cache_hash(path, len);
+	table_erase(&snapshot->table, hash, path, len);
+
+	struct frozen *f = snapshot_frozen(snapshot);
+	size_t slot = f ? frozen_find(f, hash, path, len) : SIZE_MAX;
+
+	if (slot != SIZE_MAX && frozen_removed(f, slot) == false) {
+		frozen_set_removed(f, slot, true);
+		snapshot->removed += 1;
+	}
+
+	snapshot_maybe_freeze(snapshot);
+}
+
+void cache_clear(void) {
+	for (size_t i = 0; i < CACHE_SHARDS; ++i) {
+		struct table *t = &g.runtime[i];
+		struct garbage garbage = {0};
+
+		spin_lock(&t->lock);
+		table_clear(t, &garbage);
+		spin_unlock(&t->lock);
+
+		garbage_release(&garbage);
+	}
+}
+
+void cache_key_init(struct cache_key *key, wchar_t const *path) {
+	key->path = path;
+	key->len = wstr_len(path, MAX_EXT_PATH);
+	key->hash = wstr_hash_len(path, key->len);
+}
 
-	if (n == NULL) {
+bool cache_contains(wchar_t const *path) {
+	if (path == NULL) {
 		return false;
 	}
 
-	n->path = wstr_dup(path);
+	struct cache_key key;
+	cache_key_init(&key, path);
+
+	return cache_contains_key(&key);
+}
 
-	if (n->path) {
-		n->time = time;
-		n->next = g.table[i];
-		g.table[i] = n;
+bool cache_contains_key(struct cache_key const *key) {
+	return cache_lookup(cache_key_hash(key), key->path, key->len, true);
+}
 
-		return true;
+bool cache_insert(wchar_t const *path, int64_t time) {
+	if (path == NULL) {
+		return false;
 	}
 
-	free(n);
+	size_t len = wstr_len(path, MAX_EXT_PATH);
+	if (len >= MAX_EXT_PATH) {
+		return false;
+	}
 
-	return false;
+	return runtime_insert(cache_hash(path, len), path, len, time) != CACHE_INSERT_FAILED;
 }
 
-void cache_prune(int64_t time, int64_t max_age) {
-	for (size_t i = 0; i < BLOCK_CACHE_SIZE; ++i) {
-		struct node* prev = 0;
-		struct node* n = g.table[i];
+bool cache_add(wchar_t const *path, int64_t time) {
+	if (path == NULL) {
+		return false;
+	}
 
-		while (n) {
-			struct node* next = n->next;
+	struct cache_key key;
+	cache_key_init(&key, path);
 
-			if (time - n->time > max_age) {
-				free(n->path);
-				free(n);
+	return cache_add_key(&key, time);
+}
 
-				if (prev) {
-					prev->next = next;
-				} else {
-					g.table[i] = NULL;
-				}
+bool cache_add_key(struct cache_key const *key, int64_t time) {
+	if (key->len >= MAX_EXT_PATH) {
+		return false;
+	}
+
+	uint64_t hash = cache_key_hash(key);
+	if (cache_lookup(hash, key->path, key->len, false)) {
+		return false;
+	}
+
+	return runtime_insert(hash, key->path, key->len, time) == CACHE_INSERT_ADDED;
+}
+
+void cache_remove(wchar_t const *path) {
+	if (path == NULL) {
+		return;
+	}
+
+	struct cache_key key;
+	cache_key_init(&key, path);
+
+	cache_remove_key(&key);
+}
+
+void cache_remove_key(struct cache_key const *key) {
+	uint64_t hash = cache_key_hash(key);
+	table_erase(cache_shard(hash), hash, key->path, key->len);
+}
+
+size_t cache_prune(int64_t time, int64_t max_age) {
+	int64_t deadline = time - max_age;
+	size_t pruned = 0;
+
+	for (size_t i = 0; i < CACHE_SHARDS; ++i) {
+		struct table *t = &g.runtime[i];
+
+		for (bool more = true; more;) {
+			struct garbage garbage = {0};
+
+			spin_lock(&t->lock);
+
+			pruned += table_expire(t, deadline, CACHE_PRUNE_SLICE, &more);
+			if (more == false) {
+				table_maybe_compact(t, &garbage);
 			}
 
-			n = next;
+			spin_unlock(&t->lock);
+
+			garbage_release(&garbage);
 		}
 	}
+
+	return pruned;
+}
+
+void cache_get_stats(struct cache_stats *stats) {
+	if (stats == NULL) {
+		return;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (size_t i = 0; i < CACHE_SHARDS; ++i) {
+		struct table *t = &g.runtime[i];
+
+		spin_lock(&t->lock);
+		stats->runtime_entries += t->count;
+		stats->runtime_bytes += t->live_bytes;
+		stats->evictions += t->evictions;
+		spin_unlock(&t->lock);
+	}
 }
@@ -1,24 +1,156 @@
 #pragma once
 #include "types.h"
 
+/*
+ * The block cache may be used from any number of threads. Lookups take no
+ * locks, runtime entries are spread over independently locked shards.
+ */
+
+/**
+ * Cache counters. Entries and bytes describe the runtime entries now, bytes
+ * counting their paths. Evictions accumulate until the process exits.
+ */
+struct cache_stats {
+	size_t runtime_entries;
+	size_t runtime_bytes;
+	int64_t evictions;
+};
+
+/**
+ * A path along with its length and wstr_hash, for callers that computed
+ * them while producing the path, eg. with devpath_normalize, so the cache
+ * does not walk the path again.
+ */
+struct cache_key {
+	wchar_t const *path;
+	size_t len;
+	uint64_t hash;
+};
+
+/**
+ * Fills in a key for a path, computing its length and hash.
+ */
+void cache_key_init(struct cache_key *key, wchar_t const *path);
+
+/**
+ * A set of rule paths. Snapshots are built off to the side and then
+ * published, lookups never wait for one to be built. Once published a
+ * snapshot only changes by the rule deltas of incremental refreshes.
+ */
+struct cache_snapshot;
+
+/**
+ * Creates an empty snapshot. Returns NULL on failure.
+ */
+struct cache_snapshot* cache_snapshot_create(void);
+
+/**
+ * Adds a rule path to a snapshot that has not been published yet.
+ * Returns true if the path was added or already present.
+ */
+bool cache_snapshot_insert(struct cache_snapshot *snapshot, wchar_t const *path);
+
+/**
+ * Loads a snapshot saved by cache_save. The paths are mapped from the file
+ * rather than read, so loading takes about as long as checking the file.
+ * Returns NULL if there is no usable snapshot in the file.
+ */
+struct cache_snapshot* cache_snapshot_load(wchar_t const *path);
+
 /**
- * Clears the block cache.
+ * Returns the number of paths in a snapshot.
+ */
+size_t cache_snapshot_count(struct cache_snapshot const *snapshot);
+
+/**
+ * Destroys a snapshot that has not been published.
+ */
+void cache_snapshot_destroy(struct cache_snapshot *snapshot);
+
+/**
+ * Replaces the published snapshot, which may be NULL. The previous snapshot
+ * is destroyed once the lookups using it are done, so this waits for them.
+ * Only one thread may publish at a time.
+ */
+void cache_publish(struct cache_snapshot *snapshot);
+
+/**
+ * Saves the published snapshot to a file, for cache_snapshot_load to pick
+ * up on the next launch. Only the frozen index is saved, rule deltas not yet
+ * frozen into it are left out. The file is left alone if it already holds the
+ * same index. Only the publishing thread may save. Returns true if the file
+ * is current.
+ */
+bool cache_save(wchar_t const *path);
+
+/**
+ * Adds a rule path to the published snapshot in place.
+ * Only the publishing thread may change the snapshot.
+ * Returns true if the path was added or already present.
+ */
+bool cache_rule_add(wchar_t const *path);
+
+/**
+ * Removes a rule path from the published snapshot in place.
+ * Only the publishing thread may change the snapshot.
+ */
+void cache_rule_remove(wchar_t const *path);
+
+/**
+ * Removes every runtime entry. The published snapshot is left in place.
  */
 void cache_clear(void);
 
 /**
- * Returns true if the path is in the block cache.
+ * Returns true if the path is in the published snapshot or among the
+ * runtime entries.
  */
 bool cache_contains(wchar_t const *path);
 
 /**
- * Inserts a path into the block cache. If the path already exists
- * in the cache its time is refreshed if newer.
+ * Same as cache_contains, for a path with a precomputed key.
+ */
+bool cache_contains_key(struct cache_key const *key);
+
+/**
+ * Inserts a runtime path into the block cache. If the path already exists
+ * in the cache its time is refreshed if newer. Runtime entries are kept
+ * within CACHE_MAX_ENTRIES and CACHE_MAX_BYTES by evicting those least
+ * recently looked up, rule paths are never evicted.
  * Returns true if the path was added or updated.
  */
 bool cache_insert(wchar_t const *path, int64_t time);
 
 /**
- * Prunes the cache of old entries.
+ * Inserts a runtime path unless the cache already holds it. Of several
+ * threads adding the same path only one succeeds.
+ * Returns true if the path was added by this call.
+ */
+bool cache_add(wchar_t const *path, int64_t time);
+
+/**
+ * Same as cache_add, for a path with a precomputed key.
+ */
+bool cache_add_key(struct cache_key const *key, int64_t time);
+
+/**
+ * Removes a runtime path from the block cache.
+ */
+void cache_remove(wchar_t const *path);
+
+/**
+ * Same as cache_remove, for a path with a precomputed key.
+ */
+void cache_remove_key(struct cache_key const *key);
+
+/**
+ * Prunes runtime entries not added or refreshed for more than max_age. The
+ * cost follows the number of expired entries rather than the cache size.
+ * Returns the number of entries pruned.
+ */
+size_t cache_prune(int64_t time, int64_t max_age);
+
+/**
+ * Retrieves the cache counters.
  */
-void cache_prune(int64_t time, int64_t max_age);
+void cache_get_stats(struct cache_stats *stats);
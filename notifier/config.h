@@ -6,12 +6,79 @@
  */
 #define CACHE_AGE 300000
 
+/**
+ * The maximum number of runtime entries in the block cache. Entries learned
+ * at runtime are evicted beyond it, rule paths do not count.
+ * (default: 65536)
+ */
+#define CACHE_MAX_ENTRIES 65536
+
+/**
+ * The maximum size (in bytes) of the paths of runtime entries in the block
+ * cache. Entries learned at runtime are evicted beyond it.
+ * (default: 8388608)
+ */
+#define CACHE_MAX_BYTES 8388608
+
+/**
+ * Whether the block cache knows applications by the identity of their file
+ * (the volume serial number and file ID) rather than by path, so hard links
+ * and other paths of the same file share an entry. Runtime entries then
+ * hold the identity alone, the path is only kept for the notification.
+ * (default: 0)
+ */
+#define CACHE_FILE_IDS 0
+
+/**
+ * The shortest time (in milliseconds) between polls of the rules. The poll
+ * interval starts at CACHE_AGE and halves after every refresh that finds
+ * changed rules.
+ * (default: 60000)
+ */
+#define REFRESH_INTERVAL_MIN 60000
+
+/**
+ * The longest time (in milliseconds) between polls of the rules. The poll
+ * interval doubles after every refresh that finds no changed rules.
+ * (default: 3600000)
+ */
+#define REFRESH_INTERVAL_MAX 3600000
+
+/**
+ * The quiet time (in milliseconds) after a signalled rule change before the
+ * cache is refreshed, so a burst of edits causes a single refresh.
+ * (default: 1000)
+ */
+#define RULES_DEBOUNCE 1000
+
+/**
+ * The longest time (in milliseconds) a steady stream of rule changes can
+ * hold off a refresh.
+ * (default: 10000)
+ */
+#define RULES_DEBOUNCE_MAX 10000
+
+/**
+ * The file the rule snapshot is saved to, within the local application data
+ * folder. The next launch looks events up against it until the rules have
+ * been enumerated.
+ * (default: L"firewall-notifier\\rules.cache")
+ */
+#define CACHE_FILE L"firewall-notifier\\rules.cache"
+
 /**
  * The maximum length for an extended path, null termination not included.
  * (default: 32768)
  */
 #define MAX_EXT_PATH 32768
 
+/**
+ * Maximum number of block events held from the start of monitoring until
+ * the cache is first ready. Later ones are dropped.
+ * (default: 256)
+ */
+#define STARTUP_QUEUE_SIZE 256
+
 /**
  * Maximum number of block events before newer ones are dropped.
  * (default: 32)
@@ -4,6 +4,7 @@
 #include "resource.h"
 #include "types.h"
 #include <Windows.h>
+#include <Dbt.h>
 #include <strsafe.h>
 #include <ShlObj.h>
 #include <shellapi.h>
@@ -22,10 +23,16 @@
   */
 #define WM_TRAY_COMMAND (WM_USER + 1)
 
+/**
+ * The volume device interface class, GUID_DEVINTERFACE_VOLUME.
+ */
+static GUID const VOLUME_INTERFACE = {0x53F5630D, 0xB6BF, 0x11D0, {0x94, 0xF2, 0x00, 0xA0, 0xC9, 0x1E, 0xFB, 0x8B}};
+
 static struct {
 	console_callback_t callback;
 	HWND window;
 	HMENU tray_menu;
+	HDEVNOTIFY volume_notify;
 	HICON icon_filter_on;
 	HICON icon_filter_off;
 	bool open;
@@ -84,6 +91,13 @@ static LRESULT CALLBACK message_handler(HWND wnd, UINT msg, WPARAM wparam, LPARA
 			}
 		} break;
 
+		case WM_DEVICECHANGE:
+		{
+			if (wparam == DBT_DEVICEARRIVAL || wparam == DBT_DEVICEREMOVECOMPLETE) {
+				g.callback(CONSOLE_ACTION_VOLUMES_CHANGED);
+			}
+		} break;
+
 		case WM_TRAY_COMMAND:
 		{
 			switch (lparam) {
@@ -132,6 +146,13 @@ void console_run(console_callback_t action_callback) {
 
 	g.window = wnd;
 	g.open = TRUE;
+
+	/* Message only windows miss the volume broadcasts, ask for them. */
+	DEV_BROADCAST_DEVICEINTERFACE_W filter = {0};
+	filter.dbcc_size = sizeof(filter);
+	filter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+	filter.dbcc_classguid = VOLUME_INTERFACE;
+	g.volume_notify = RegisterDeviceNotificationW(wnd, &filter, DEVICE_NOTIFY_WINDOW_HANDLE);
 	g.tray_menu = CreatePopupMenu();
 
 	if (g.tray_menu) {
@@ -170,6 +191,10 @@ void console_run(console_callback_t action_callback) {
 		Shell_NotifyIconW(NIM_DELETE, &g.nid);
 	}
 
+	if (g.volume_notify) {
+		UnregisterDeviceNotification(g.volume_notify);
+	}
+
 	DestroyWindow(wnd);
 	UnregisterClassW(wc.lpszClassName, wc.hInstance);
 
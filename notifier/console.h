@@ -7,7 +7,8 @@ enum CONSOLE_ACTION
 {
 	CONSOLE_ACTION_INVALID,
 	CONSOLE_ACTION_OPEN_RULES,
-	CONSOLE_ACTION_REBUILD_CACHE
+	CONSOLE_ACTION_REBUILD_CACHE,
+	CONSOLE_ACTION_VOLUMES_CHANGED
 };
 
 /**
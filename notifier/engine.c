@@ -0,0 +1,669 @@
+#include "engine.h"
+#include "cache.h"
+#include "config.h"
+#include "memory.h"
+#include "path.h"
+#include "platform.h"
+#include "queue.h"
+#include "ruleset.h"
+#include "wstr.h"
+#include <string.h>
+
+/**
+ * Paths up to this length are converted on the stack of the calling thread,
+ * longer ones in a buffer of their own.
+ */
+#define DROP_PATH_SIZE 1024
+
+/**
+ * Room for the DOS name of a drive beyond the length of its device path.
+ */
+#define DROP_DRIVE_SIZE 256
+
+/**
+ * Number of counter sets, a power of two. Threads count into the set of
+ * their stripe so busy callbacks do not contend on the same cache line.
+ */
+#define STAT_STRIPES 16
+
+/**
+ * Engine counters of one stripe.
+ */
+struct counters {
+	int64_t volatile events;
+	int64_t volatile invalid_paths;
+	int64_t volatile cache_hits;
+	int64_t volatile cache_misses;
+	int64_t volatile queue_drops;
+	int64_t volatile rebuilds;
+	int64_t volatile notifications;
+	int64_t volatile rules_added;
+	int64_t volatile rule_paths_added;
+	int64_t volatile rule_paths_removed;
+	int64_t volatile rule_ids_added;
+	int64_t volatile rule_ids_removed;
+	int64_t volatile rule_changes;
+	int64_t volatile churn_refreshes;
+	int64_t volatile rule_churn;
+	int64_t volatile expired;
+	int64_t volatile startup_held;
+	int64_t volatile startup_drops;
+	uint8_t padding[64];
+};
+
+/**
+ * Engine state. The lock guards the refresh bookkeeping and the paths held
+ * at startup, the cache and queue synchronize themselves. A burst of rule
+ * changes runs from changed_first to changed_last. The snapshot is saved to
+ * snapshot_path after every refresh if there is one. Until the cache is
+ * first ready, converted paths are held rather than looked up.
+ */
+static struct {
+	struct engine_hooks hooks;
+	platform_lock_t lock;
+	platform_lock_t refresh_lock;
+	platform_cond_t refresh_cond;
+	platform_thread_t refresher;
+	bool refresher_running;
+	bool watching;
+	struct cache_snapshot *building;
+	bool published;
+	int64_t cache_time;
+	int64_t prune_time;
+	int64_t interval;
+	bool stale;
+	bool changed;
+	int64_t changed_first;
+	int64_t changed_last;
+	wchar_t *snapshot_path;
+	int64_t volatile ready;
+	wchar_t *held[STARTUP_QUEUE_SIZE];
+	size_t held_count;
+	int64_t volatile closed;
+	struct counters stats[STAT_STRIPES];
+} g;
+
+/**
+ * Returns the counters of the calling thread.
+ */
+static struct counters* counters(void) {
+	return &g.stats[platform_thread_stripe(STAT_STRIPES)];
+}
+
+/**
+ * Adds a path or file identity newly covered by a rule, to the snapshot
+ * being built or in place to the published one.
+ */
+static void rule_path_added(wchar_t const *path) {
+	if (g.building) {
+		cache_snapshot_insert(g.building, path);
+	} else {
+		cache_rule_add(path);
+	}
+
+	struct counters* c = counters();
+	platform_atomic_add(path_is_id_key(path, wstr_len(path, PATH_ID_KEY_LEN + 1)) ? &c->rule_ids_added : &c->rule_paths_added, 1);
+}
+
+/**
+ * Removes a path or file identity no rule covers anymore. A runtime entry for it, eg. from a
+ * rule created by the notifier, goes too so it is not kept until it ages out.
+ */
+static void rule_path_removed(wchar_t const *path) {
+	cache_rule_remove(path);
+	cache_remove(path);
+
+	struct counters* c = counters();
+	platform_atomic_add(path_is_id_key(path, wstr_len(path, PATH_ID_KEY_LEN + 1)) ? &c->rule_ids_removed : &c->rule_paths_removed, 1);
+}
+
+/**
+ * Handles an enumerated firewall rule.
+ */
+static void rule_enum(struct firewall_rule const *rule) {
+	ruleset_visit(rule, rule_path_added, rule_path_removed);
+}
+
+/**
+ * Backs the poll interval off while the rules stay the same and tightens it
+ * once they change. Full rebuilds say nothing about churn and are skipped,
+ * and so is everything while the rules are watched rather than polled.
+ */
+static void adapt_interval(int64_t churn) {
+	platform_lock_enter(&g.lock);
+
+	if (g.watching) {
+		platform_lock_leave(&g.lock);
+		return;
+	}
+
+	if (churn > 0) {
+		g.interval /= 2;
+		if (g.interval < REFRESH_INTERVAL_MIN) {
+			g.interval = REFRESH_INTERVAL_MIN;
+		}
+	} else {
+		g.interval *= 2;
+		if (g.interval > REFRESH_INTERVAL_MAX) {
+			g.interval = REFRESH_INTERVAL_MAX;
+		}
+	}
+
+	platform_lock_leave(&g.lock);
+
+	if (churn > 0) {
+		struct counters* c = counters();
+		platform_atomic_add(&c->churn_refreshes, 1);
+		platform_atomic_add(&c->rule_churn, churn);
+	}
+}
+
+/**
+ * Holds a path seen before the cache was first ready, to be looked up once
+ * it is. Returns false if the cache became ready in the meantime.
+ */
+static bool hold_path(struct cache_key const* key) {
+	platform_lock_enter(&g.lock);
+
+	bool held = platform_atomic_load(&g.ready) == 0;
+	if (held) {
+		wchar_t* copy = g.held_count < STARTUP_QUEUE_SIZE ? wstr_dup(key->path) : NULL;
+
+		if (copy) {
+			g.held[g.held_count++] = copy;
+			platform_atomic_add(&counters()->startup_held, 1);
+		} else {
+			platform_atomic_add(&counters()->startup_drops, 1);
+		}
+	}
+
+	platform_lock_leave(&g.lock);
+
+	return held;
+}
+
+/**
+ * Looks up a converted path, queueing a notification if it is unknown.
+ */
+static void drop_path(struct cache_key const* key) {
+	struct counters* c = counters();
+
+	if (platform_atomic_load(&g.ready) == 0 && hold_path(key)) {
+		return;
+	}
+
+	/* A file with an identity is known by it, rules by their path too. */
+	wchar_t id[PATH_ID_KEY_LEN + 1];
+	struct cache_key id_key;
+	id_key.path = id;
+	id_key.len = 0;
+	id_key.hash = 0;
+	bool identified = path_identify(id, PATH_ID_KEY_LEN + 1, key->path, key->len, key->hash, &id_key.len, &id_key.hash);
+	struct cache_key const* entry = identified ? &id_key : key;
+
+	if (cache_contains_key(entry) || (identified && cache_contains_key(key))) {
+		platform_atomic_add(&c->cache_hits, 1);
+		return;
+	}
+
+	platform_atomic_add(&c->cache_misses, 1);
+
+	/* Claim the path first so threads racing on the same unknown application
+	 * queue it only once. If the queue is full it is released again. */
+	if (cache_add_key(entry, g.hooks.time())) {
+		if (queue_enqueue(key->path, key->len) == false) {
+			cache_remove_key(entry);
+			platform_atomic_add(&c->queue_drops, 1);
+		}
+	}
+}
+
+/**
+ * Marks the cache ready once the first snapshot is published, then looks up
+ * the paths held until now.
+ */
+static void set_ready(void) {
+	if (platform_atomic_load(&g.ready)) {
+		return;
+	}
+
+	/* Nothing is held anymore once ready is set, the paths are ours. */
+	platform_lock_enter(&g.lock);
+	platform_atomic_cas(&g.ready, 0, 1);
+	size_t count = g.held_count;
+	g.held_count = 0;
+	platform_lock_leave(&g.lock);
+
+	for (size_t i = 0; i < count; ++i) {
+		struct cache_key key;
+		cache_key_init(&key, g.held[i]);
+
+		drop_path(&key);
+		memory_free(g.held[i]);
+		g.held[i] = NULL;
+	}
+}
+
+/**
+ * Enumerates the firewall rules and applies the changes since the last
+ * refresh to the published snapshot, then prunes runtime entries older than
+ * max_age. A full refresh instead builds a new snapshot off to the side from
+ * every rule and publishes it. The engine lock is only taken for the
+ * bookkeeping, lookups carry on while the rules are enumerated.
+ */
+static void refresh(bool full, int64_t max_age) {
+	platform_lock_enter(&g.refresh_lock);
+
+	/* Invalidations arriving during the enumeration trigger another refresh. */
+	platform_lock_enter(&g.lock);
+	int64_t now = g.hooks.time();
+	g.cache_time = now;
+	g.prune_time = now;
+	g.stale = false;
+	g.changed = false;
+	platform_lock_leave(&g.lock);
+
+	/* Without a published snapshot there is nothing to apply changes to. */
+	if (full || g.published == false) {
+		g.building = cache_snapshot_create();
+		if (g.building) {
+			ruleset_clear();
+		}
+	}
+
+	struct ruleset_stats before;
+	ruleset_get_stats(&before);
+
+	ruleset_begin();
+	bool complete = g.hooks.rules_enum(rule_enum);
+	ruleset_end(complete, rule_path_removed);
+
+	if (g.building) {
+		cache_publish(g.building);
+		g.building = NULL;
+		g.published = true;
+		set_ready();
+	} else {
+		struct ruleset_stats after;
+		ruleset_get_stats(&after);
+
+		adapt_interval((after.rules_added - before.rules_added) + (after.rules_removed - before.rules_removed));
+	}
+
+	if (max_age < 0) {
+		cache_clear();
+	} else {
+		platform_atomic_add(&counters()->expired, (int64_t)cache_prune(now, max_age));
+	}
+
+	platform_atomic_add(&counters()->rebuilds, 1);
+
+	/* Saving is skipped until the snapshot is refrozen. */
+	if (g.snapshot_path) {
+		cache_save(g.snapshot_path);
+	}
+
+	platform_lock_leave(&g.refresh_lock);
+}
+
+/**
+ * Prunes runtime entries older than CACHE_AGE without enumerating the rules.
+ */
+static void prune(void) {
+	platform_lock_enter(&g.refresh_lock);
+
+	platform_lock_enter(&g.lock);
+	int64_t now = g.hooks.time();
+	g.prune_time = now;
+	platform_lock_leave(&g.lock);
+
+	platform_atomic_add(&counters()->expired, (int64_t)cache_prune(now, CACHE_AGE));
+
+	platform_lock_leave(&g.refresh_lock);
+}
+
+/**
+ * Returns the time the rules are due to be enumerated again. Requires the
+ * lock to be held.
+ */
+static int64_t refresh_time(void) {
+	if (g.stale) {
+		return g.cache_time;
+	}
+
+	if (g.watching == false) {
+		return g.cache_time + g.interval;
+	}
+
+	/* A change the watch misses is still picked up within CACHE_AGE. */
+	if (g.changed == false) {
+		return g.cache_time + CACHE_AGE;
+	}
+
+	int64_t settled = g.changed_last + RULES_DEBOUNCE;
+	int64_t limit = g.changed_first + RULES_DEBOUNCE_MAX;
+
+	return settled < limit ? settled : limit;
+}
+
+/**
+ * Returns true if the cache should be refreshed. Requires the lock to be held.
+ */
+static bool refresh_due(int64_t now) {
+	return now >= refresh_time();
+}
+
+/**
+ * Returns true if runtime entries should be pruned on their own, because
+ * the rules are not enumerated at least every CACHE_AGE. Requires the lock
+ * to be held.
+ */
+static bool prune_due(int64_t now) {
+	return now - g.prune_time >= CACHE_AGE;
+}
+
+/**
+ * Notes a signalled rule change and wakes the refresher to wait for the
+ * burst of changes to settle.
+ */
+static void rules_changed(void) {
+	platform_lock_enter(&g.lock);
+
+	int64_t now = g.hooks.time();
+	if (g.changed == false) {
+		g.changed = true;
+		g.changed_first = now;
+	}
+
+	g.changed_last = now;
+
+	platform_cond_wake(&g.refresh_cond);
+	platform_lock_leave(&g.lock);
+
+	platform_atomic_add(&counters()->rule_changes, 1);
+}
+
+/**
+ * Background refresher thread, refreshes or prunes the cache whenever it is due.
+ */
+static void refresher_main(void *arg) {
+	(void)arg;
+
+	platform_lock_enter(&g.lock);
+
+	while (platform_atomic_load(&g.closed) == 0) {
+		int64_t now = g.hooks.time();
+
+		if (refresh_due(now)) {
+			platform_lock_leave(&g.lock);
+			refresh(false, CACHE_AGE);
+			platform_lock_enter(&g.lock);
+		} else if (prune_due(now)) {
+			platform_lock_leave(&g.lock);
+			prune();
+			platform_lock_enter(&g.lock);
+		} else {
+			int64_t next = refresh_time();
+			if (g.prune_time + CACHE_AGE < next) {
+				next = g.prune_time + CACHE_AGE;
+			}
+
+			platform_cond_wait_timeout(&g.refresh_cond, &g.lock, next - now);
+		}
+	}
+
+	platform_lock_leave(&g.lock);
+}
+
+void engine_create(struct engine_hooks const* hooks) {
+	g.hooks = *hooks;
+	g.cache_time = g.hooks.time();
+	g.prune_time = g.cache_time;
+	g.interval = CACHE_AGE;
+	g.stale = true;
+	g.changed = false;
+	g.closed = 0;
+	g.refresher_running = false;
+	g.watching = false;
+	g.published = false;
+	g.snapshot_path = NULL;
+	g.ready = 0;
+	g.held_count = 0;
+
+	platform_lock_create(&g.lock);
+	platform_lock_create(&g.refresh_lock);
+	platform_cond_create(&g.refresh_cond);
+	queue_create();
+}
+
+bool engine_load(wchar_t const* path) {
+	platform_lock_enter(&g.refresh_lock);
+
+	memory_free(g.snapshot_path);
+	g.snapshot_path = wstr_dup(path);
+
+	/* The cache stays stale, so the first refresh enumerates every rule
+	 * into a new snapshot and replaces the loaded one. */
+	struct cache_snapshot *snapshot = g.published ? NULL : cache_snapshot_load(path);
+	if (snapshot) {
+		cache_publish(snapshot);
+		set_ready();
+	}
+
+	platform_lock_leave(&g.refresh_lock);
+
+	return snapshot != NULL;
+}
+
+bool engine_watch(void) {
+	if (g.hooks.rules_watch == NULL || g.hooks.rules_unwatch == NULL) {
+		return false;
+	}
+
+	platform_lock_enter(&g.lock);
+	if (g.watching == false) {
+		g.watching = g.hooks.rules_watch(rules_changed);
+	}
+	bool watching = g.watching;
+	platform_lock_leave(&g.lock);
+
+	return watching;
+}
+
+bool engine_start(void) {
+	if (g.refresher_running) {
+		return true;
+	}
+
+	g.refresher_running = platform_thread_create(&g.refresher, refresher_main, NULL);
+	return g.refresher_running;
+}
+
+void engine_close(void) {
+	platform_lock_enter(&g.lock);
+	platform_atomic_cas(&g.closed, 0, 1);
+	platform_cond_wake_all(&g.refresh_cond);
+	bool watching = g.watching;
+	platform_lock_leave(&g.lock);
+
+	/* Change callbacks take the lock, so the watch is stopped outside of it. */
+	if (watching) {
+		g.hooks.rules_unwatch();
+	}
+
+	if (g.refresher_running) {
+		platform_thread_join(&g.refresher);
+		g.refresher_running = false;
+	}
+
+	queue_close();
+}
+
+void engine_destroy(void) {
+	cache_clear();
+	cache_publish(NULL);
+	ruleset_clear();
+	g.published = false;
+
+	memory_free(g.snapshot_path);
+	g.snapshot_path = NULL;
+
+	/* Paths held by a cache that never became ready. */
+	for (size_t i = 0; i < g.held_count; ++i) {
+		memory_free(g.held[i]);
+		g.held[i] = NULL;
+	}
+
+	g.held_count = 0;
+	g.ready = 0;
+
+	queue_destroy();
+	platform_cond_destroy(&g.refresh_cond);
+	platform_lock_destroy(&g.refresh_lock);
+	platform_lock_destroy(&g.lock);
+}
+
+void engine_drop_event(wchar_t const* dev_path) {
+	platform_atomic_add(&counters()->events, 1);
+
+	if (platform_atomic_load(&g.closed)) {
+		return;
+	}
+
+	/* Fix the path name, folding and hashing it in the same pass. Refreshes
+	 * happen in the background, just search the cache. */
+	wchar_t path[DROP_PATH_SIZE];
+	struct cache_key key;
+	key.path = path;
+	key.len = 0;
+	key.hash = 0;
+
+	if (g.hooks.dospath(path, DROP_PATH_SIZE, dev_path, &key.len, &key.hash)) {
+		drop_path(&key);
+		return;
+	}
+
+	/* Too long for the stack buffer, or not a valid path at all. A DOS path
+	 * is at most a drive name longer than its device path. */
+	size_t len = wstr_len(dev_path, MAX_EXT_PATH);
+	bool valid = false;
+
+	if (len >= DROP_PATH_SIZE - DROP_DRIVE_SIZE && len < MAX_EXT_PATH) {
+		size_t count = len + DROP_DRIVE_SIZE;
+		wchar_t* long_path = MEMORY_ALLOC_COUNT(MEMORY_TAG_GENERAL, long_path, count);
+
+		key.path = long_path;
+		valid = long_path && g.hooks.dospath(long_path, count, dev_path, &key.len, &key.hash);
+		if (valid) {
+			drop_path(&key);
+		}
+
+		memory_free(long_path);
+	}
+
+	if (valid == false) {
+		platform_atomic_add(&counters()->invalid_paths, 1);
+	}
+}
+
+void engine_invalidate(void) {
+	/* The refresher picks the cache up again as soon as it is woken. */
+	platform_lock_enter(&g.lock);
+	if (g.watching == false) {
+		g.stale = true;
+		platform_cond_wake(&g.refresh_cond);
+	}
+	platform_lock_leave(&g.lock);
+}
+
+bool engine_refresh(void) {
+	platform_lock_enter(&g.lock);
+	int64_t now = g.hooks.time();
+	bool open = platform_atomic_load(&g.closed) == 0;
+	bool due = open && refresh_due(now);
+	bool prune_only = open && due == false && prune_due(now);
+	platform_lock_leave(&g.lock);
+
+	if (due) {
+		refresh(false, CACHE_AGE);
+	} else if (prune_only) {
+		prune();
+	}
+
+	return due;
+}
+
+void engine_rebuild(void) {
+	/* Runtime entries are dropped once the new snapshot is in place. */
+	refresh(true, -1);
+}
+
+bool engine_notify(bool wait) {
+	wchar_t* path = wait ? queue_dequeue() : queue_try_dequeue();
+	if (path == NULL) {
+		return false;
+	}
+
+	platform_atomic_add(&counters()->notifications, 1);
+
+	enum NOTIFIER_ACTION a = g.hooks.notify(path);
+	if (a != NOTIFIER_ACTION_SKIP) {
+		if (g.hooks.rules_add(path, path, a == NOTIFIER_ACTION_ALLOW)) {
+			platform_atomic_add(&counters()->rules_added, 1);
+
+			/* Refreshed under the key drop_path claimed it by. */
+			wchar_t id[PATH_ID_KEY_LEN + 1];
+			size_t id_len = 0;
+			uint64_t id_hash = 0;
+			size_t len = wstr_len(path, MAX_EXT_PATH);
+			bool identified = path_identify(id, PATH_ID_KEY_LEN + 1, path, len, wstr_hash_len(path, len), &id_len, &id_hash);
+
+			cache_insert(identified ? id : path, g.hooks.time());
+		}
+	}
+
+	memory_free(path);
+
+	return true;
+}
+
+void engine_get_stats(struct engine_stats* stats) {
+	if (stats == NULL) {
+		return;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (size_t i = 0; i < STAT_STRIPES; ++i) {
+		struct counters const* c = &g.stats[i];
+
+		stats->events += platform_atomic_load(&c->events);
+		stats->invalid_paths += platform_atomic_load(&c->invalid_paths);
+		stats->cache_hits += platform_atomic_load(&c->cache_hits);
+		stats->cache_misses += platform_atomic_load(&c->cache_misses);
+		stats->queue_drops += platform_atomic_load(&c->queue_drops);
+		stats->rebuilds += platform_atomic_load(&c->rebuilds);
+		stats->notifications += platform_atomic_load(&c->notifications);
+		stats->rules_added += platform_atomic_load(&c->rules_added);
+		stats->rule_paths_added += platform_atomic_load(&c->rule_paths_added);
+		stats->rule_paths_removed += platform_atomic_load(&c->rule_paths_removed);
+		stats->rule_ids_added += platform_atomic_load(&c->rule_ids_added);
+		stats->rule_ids_removed += platform_atomic_load(&c->rule_ids_removed);
+		stats->rule_changes += platform_atomic_load(&c->rule_changes);
+		stats->churn_refreshes += platform_atomic_load(&c->churn_refreshes);
+		stats->rule_churn += platform_atomic_load(&c->rule_churn);
+		stats->expired += platform_atomic_load(&c->expired);
+		stats->startup_held += platform_atomic_load(&c->startup_held);
+		stats->startup_drops += platform_atomic_load(&c->startup_drops);
+	}
+
+	platform_lock_enter(&g.lock);
+	stats->refresh_interval = g.interval;
+	platform_lock_leave(&g.lock);
+
+	struct cache_stats cache;
+	cache_get_stats(&cache);
+	stats->evictions = cache.evictions;
+	stats->runtime_entries = (int64_t)cache.runtime_entries;
+	stats->runtime_bytes = (int64_t)cache.runtime_bytes;
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include "firewall.h"
+#include "notifier.h"
+#include "types.h"
+
+/**
+ * The services the engine depends on. Replacing them allows the event
+ * handling logic to run against fakes, eg. in the replay simulator.
+ */
+struct engine_hooks {
+	/* Returns the value of a monotonic clock, in milliseconds. */
+	int64_t (*time)(void);
+
+	/* Converts an NT device path to a lowercase DOS path, along with its
+	 * length and wstr_hash. */
+	bool (*dospath)(wchar_t* dos_path, size_t dos_path_count, wchar_t const* dev_path, size_t* len, uint64_t* hash);
+
+	/* Enumerates the firewall rules, returns false if not all of them were. */
+	bool (*rules_enum)(firewall_callback_t enum_callback);
+
+	/* Starts calling the callback whenever rules may have changed, returns
+	 * false if they cannot be watched. Optional, along with rules_unwatch. */
+	bool (*rules_watch)(firewall_change_t change_callback);
+
+	/* Stops watching the rules. */
+	void (*rules_unwatch)(void);
+
+	/* Adds a new rule to the firewall. */
+	bool (*rules_add)(wchar_t const* name, wchar_t const* path, bool allow);
+
+	/* Shows a notification and returns the chosen action. */
+	enum NOTIFIER_ACTION (*notify)(wchar_t const* path);
+};
+
+/**
+ * Engine counters, accumulated since the engine was created. The refresh
+ * interval is the current time between polls of the rules, rule churn the
+ * number of rules added or removed as found by periodic refreshes. Rule
+ * paths and rule ids count the paths and path_identify keys of rules apart,
+ * a rule whose file has an identity adds to both. Runtime entries and bytes
+ * describe the entries the cache holds besides rule paths now, bytes
+ * counting their keys.
+ * Startup held and drops count the events that arrived before the cache was
+ * first ready, and were looked up once it was or did not fit to be held.
+ */
+struct engine_stats {
+	int64_t events;
+	int64_t invalid_paths;
+	int64_t cache_hits;
+	int64_t cache_misses;
+	int64_t queue_drops;
+	int64_t rebuilds;
+	int64_t notifications;
+	int64_t rules_added;
+	int64_t rule_paths_added;
+	int64_t rule_paths_removed;
+	int64_t rule_ids_added;
+	int64_t rule_ids_removed;
+	int64_t rule_changes;
+	int64_t refresh_interval;
+	int64_t churn_refreshes;
+	int64_t rule_churn;
+	int64_t expired;
+	int64_t evictions;
+	int64_t runtime_entries;
+	int64_t runtime_bytes;
+	int64_t startup_held;
+	int64_t startup_drops;
+};
+
+/**
+ * Creates the engine and the notification queue it feeds.
+ */
+void engine_create(struct engine_hooks const* hooks);
+
+/**
+ * Publishes the rule snapshot saved to a file by an earlier run, so events
+ * are looked up against it from the start. The cache stays stale and the
+ * first refresh replaces the snapshot with one of the current rules. From
+ * then on the snapshot is saved to the file after refreshes that changed
+ * it. Returns true if a saved snapshot was loaded.
+ */
+bool engine_load(wchar_t const* path);
+
+/**
+ * Starts watching the firewall rules. While they are watched, rules are
+ * enumerated again once a change was signalled and no other followed for
+ * RULES_DEBOUNCE, and at least every CACHE_AGE in case a change went
+ * unsignalled. Otherwise they are polled at an interval adapting to how
+ * often they change. Returns true on success.
+ */
+bool engine_watch(void);
+
+/**
+ * Starts the background refresher, which refreshes the cache whenever it is
+ * stale or due. Returns true on success.
+ */
+bool engine_start(void);
+
+/**
+ * Stops accepting events, stops watching rules and the refresher and releases any thread waiting in engine_notify.
+ */
+void engine_close(void);
+
+/**
+ * Destroys the engine. No other engine functions may be running.
+ */
+void engine_destroy(void);
+
+/**
+ * Handles a dropped network event. May occur from multiple threads at
+ * once so care is taken to avoid race conditions. Events may arrive before
+ * the cache is ready, up to STARTUP_QUEUE_SIZE are held until it is. Files
+ * with a path_identify key are looked up and remembered by it, the queue
+ * still gets their path to show.
+ */
+void engine_drop_event(wchar_t const* dev_path);
+
+/**
+ * Marks the cache as stale and wakes the refresher to rebuild it. Ignored
+ * while the rules are watched, since any edit is signalled anyway.
+ */
+void engine_invalidate(void);
+
+/**
+ * Refreshes or prunes the cache from the calling thread if either is due,
+ * for callers that drive the engine without the refresher. Returns true if
+ * the cache was refreshed.
+ */
+bool engine_refresh(void);
+
+/**
+ * Rebuilds the cache immediately and drops every runtime entry.
+ */
+void engine_rebuild(void);
+
+/**
+ * Shows a notification for the next queued path and applies its action.
+ * If wait is true, waits until a path is available or the engine is closed.
+ * Returns false if no path was handled.
+ */
+bool engine_notify(bool wait);
+
+/**
+ * Retrieves the engine counters.
+ */
+void engine_get_stats(struct engine_stats* stats);
@@ -1,6 +1,5 @@
 #include "firewall.h"
 #include "types.h"
-#include "wstr.h"
 #include <netfw.h>
 
 /**
@@ -12,6 +11,16 @@ static NET_FW_PROFILE_TYPE2 const PROFILE_TYPES[] = {
 	NET_FW_PROFILE2_DOMAIN
 };
 
+/**
+ * Registry keys holding the local and the group policy rule stores. The
+ * policy store only exists once a policy was applied, so its parent is
+ * watched instead and sees the store being created.
+ */
+static wchar_t const *const WATCH_KEYS[] = {
+	L"SYSTEM\\CurrentControlSet\\Services\\SharedAccess\\Parameters\\FirewallPolicy",
+	L"SOFTWARE\\Policies\\Microsoft"
+};
+
 /**
  * Firewall interface state.
  */
@@ -22,39 +31,85 @@ static struct {
 } g;
 
 /**
- * Returns true if the firewall rule is a valid one for the block cache.
+ * Rule store watch state. The first event stops the watcher, the others
+ * are signalled by the watched keys.
  */
-static bool firewall_is_valid_rule(INetFwRule *rule) {
-	if (rule == NULL) {
-		return false;
-	}
+static struct {
+	firewall_change_t change_callback;
+	HKEY keys[ARRAYSIZE(WATCH_KEYS)];
+	HANDLE events[ARRAYSIZE(WATCH_KEYS) + 1];
+	DWORD key_count;
+	HANDLE watcher;
+} w;
 
+/**
+ * Reads the properties of a firewall rule and passes them to the callback.
+ */
+static void firewall_visit_rule(INetFwRule *rule, firewall_callback_t enum_callback) {
 	NET_FW_RULE_DIRECTION dir;
-	if (FAILED(rule->lpVtbl->get_Direction(rule, &dir)) || dir == NET_FW_RULE_DIR_IN) {
-		return false;
+	VARIANT_BOOL status;
+	NET_FW_ACTION action;
+
+	if (FAILED(rule->lpVtbl->get_Direction(rule, &dir)) ||
+		FAILED(rule->lpVtbl->get_Enabled(rule, &status)) ||
+		FAILED(rule->lpVtbl->get_Action(rule, &action))) {
+		return;
 	}
 
-	VARIANT_BOOL status;
-	if (FAILED(rule->lpVtbl->get_Enabled(rule, &status)) || status != VARIANT_TRUE) {
-		return false;
+	BSTR name = NULL;
+	BSTR path = NULL;
+	BSTR ports = NULL;
+
+	if (SUCCEEDED(rule->lpVtbl->get_Name(rule, &name)) &&
+		SUCCEEDED(rule->lpVtbl->get_ApplicationName(rule, &path)) &&
+		SUCCEEDED(rule->lpVtbl->get_LocalPorts(rule, &ports))) {
+		struct firewall_rule r;
+		r.name = name;
+		r.path = path;
+		r.ports = ports;
+		r.outbound = dir == NET_FW_RULE_DIR_OUT;
+		r.enabled = status == VARIANT_TRUE;
+		r.allow = action == NET_FW_ACTION_ALLOW;
+
+		enum_callback(&r);
 	}
 
-	bool result = false;
+	SysFreeString(ports);
+	SysFreeString(path);
+	SysFreeString(name);
+}
 
-	BSTR ports;
-	if (SUCCEEDED(rule->lpVtbl->get_LocalPorts(rule, &ports))) {
-		NET_FW_ACTION action;
-		if (SUCCEEDED(rule->lpVtbl->get_Action(rule, &action))) {
-			if (action == NET_FW_ACTION_BLOCK ||
-				(action == NET_FW_ACTION_ALLOW && (ports == NULL || wcscmp(ports, L"*") == 0))) {
-				result = true;
-			}
+/**
+ * Requests a single change notification for a watched key.
+ */
+static void firewall_watch_arm(DWORD i) {
+	DWORD filter = REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET;
+	RegNotifyChangeKeyValue(w.keys[i], TRUE, filter, w.events[i + 1], TRUE);
+}
+
+/**
+ * Rule store watcher thread.
+ */
+static DWORD WINAPI firewall_watcher(LPVOID lp) {
+	UNREFERENCED_PARAMETER(lp);
+
+	/* Notification requests end with the thread that made them, so they are all made here. */
+	for (DWORD i = 0; i < w.key_count; ++i) {
+		firewall_watch_arm(i);
+	}
+
+	for (;;) {
+		DWORD result = WaitForMultipleObjects(w.key_count + 1, w.events, FALSE, INFINITE);
+		if (result <= WAIT_OBJECT_0 || result > WAIT_OBJECT_0 + w.key_count) {
+			break;
 		}
 
-		SysFreeString(ports);
+		/* Rearm first so changes made during the callback are not missed. */
+		firewall_watch_arm(result - WAIT_OBJECT_0 - 1);
+		w.change_callback();
 	}
 
-	return result;
+	return 0;
 }
 
 void firewall_create(void) {
@@ -70,6 +125,8 @@ void firewall_create(void) {
 }
 
 void firewall_destroy(void) {
+	firewall_unwatch();
+
 	if (g.rules) {
 		g.rules->lpVtbl->Release(g.rules);
 	}
@@ -124,16 +181,18 @@ bool firewall_add(wchar_t const *name, wchar_t const *path, bool allow) {
 	return result;
 }
 
-void firewall_enum(firewall_callback_t enum_callback) {
+bool firewall_enum(firewall_callback_t enum_callback) {
 	if (g.initialized == false || enum_callback == NULL) {
-		return;
+		return false;
 	}
 
 	IUnknown *temp;
 	if (FAILED(g.rules->lpVtbl->get__NewEnum(g.rules, &temp))) {
-		return;
+		return false;
 	}
 
+	bool result = false;
+
 	IEnumVARIANT *enum_var;
 	if (SUCCEEDED(temp->lpVtbl->QueryInterface(temp, &IID_IEnumVARIANT, &enum_var))) {
 		for (;;) {
@@ -142,21 +201,14 @@ void firewall_enum(firewall_callback_t enum_callback) {
 
 			HRESULT hr = enum_var->lpVtbl->Next(enum_var, 1, &var, &fetched);
 			if (FAILED(hr) || hr == S_FALSE) {
+				result = SUCCEEDED(hr);
 				break;
 			}
 
 			if (var.vt == VT_DISPATCH && var.pdispVal != NULL) {
 				INetFwRule *rule;
 				if (SUCCEEDED(var.pdispVal->lpVtbl->QueryInterface(var.pdispVal, &IID_INetFwRule, &rule))) {
-					if (firewall_is_valid_rule(rule)) {
-						BSTR name;
-						if (SUCCEEDED(rule->lpVtbl->get_ApplicationName(rule, &name)) && name) {
-							wstr_lower(name);
-							enum_callback(name);
-							SysFreeString(name);
-						}
-					}
-
+					firewall_visit_rule(rule, enum_callback);
 					rule->lpVtbl->Release(rule);
 				}
 			}
@@ -168,6 +220,61 @@ void firewall_enum(firewall_callback_t enum_callback) {
 	}
 
 	temp->lpVtbl->Release(temp);
+
+	return result;
+}
+
+bool firewall_watch(firewall_change_t change_callback) {
+	if (change_callback == NULL || w.watcher) {
+		return false;
+	}
+
+	for (size_t i = 0; i < ARRAYSIZE(WATCH_KEYS); ++i) {
+		HKEY key;
+		if (RegOpenKeyExW(HKEY_LOCAL_MACHINE, WATCH_KEYS[i], 0, KEY_NOTIFY, &key) == ERROR_SUCCESS) {
+			w.keys[w.key_count++] = key;
+		} else if (i == 0) {
+			return false;
+		}
+	}
+
+	w.change_callback = change_callback;
+
+	for (DWORD i = 0; i <= w.key_count; ++i) {
+		w.events[i] = CreateEventW(NULL, FALSE, FALSE, NULL);
+		if (w.events[i] == NULL) {
+			firewall_unwatch();
+			return false;
+		}
+	}
+
+	w.watcher = CreateThread(NULL, 0, firewall_watcher, NULL, 0, NULL);
+	if (w.watcher == NULL) {
+		firewall_unwatch();
+		return false;
+	}
+
+	return true;
+}
+
+void firewall_unwatch(void) {
+	if (w.watcher) {
+		SetEvent(w.events[0]);
+		WaitForSingleObject(w.watcher, INFINITE);
+		CloseHandle(w.watcher);
+	}
+
+	for (size_t i = 0; i < ARRAYSIZE(w.events); ++i) {
+		if (w.events[i]) {
+			CloseHandle(w.events[i]);
+		}
+	}
+
+	for (DWORD i = 0; i < w.key_count; ++i) {
+		RegCloseKey(w.keys[i]);
+	}
+
+	SecureZeroMemory(&w, sizeof(w));
 }
 
 bool firewall_get_filtering(void) {
@@ -2,9 +2,29 @@
 #include "types.h"
 
 /**
- * Firewall enumeration callback.
+ * The properties of an enumerated firewall rule that decide whether it
+ * puts its application in the block cache. Strings may be NULL.
  */
-typedef void (*firewall_callback_t)(wchar_t const *drive_path);
+struct firewall_rule {
+	wchar_t const *name;
+	wchar_t const *path;
+	wchar_t const *ports;
+	bool outbound;
+	bool enabled;
+	bool allow;
+};
+
+/**
+ * Firewall enumeration callback. The rule application path is as the rule
+ * stores it, see path_canonicalize.
+ */
+typedef void (*firewall_callback_t)(struct firewall_rule const *rule);
+
+/**
+ * Firewall change callback. Called from a background thread whenever rules
+ * may have changed, often several times for a single edit.
+ */
+typedef void (*firewall_change_t)(void);
 
 /**
  * Creates the firewall interface.
@@ -23,8 +43,20 @@ bool firewall_add(wchar_t const *name, wchar_t const *path, bool allow);
 
 /**
  * Enumerates rules in the firewall.
+ * Returns false if the rules could not all be enumerated.
+ */
+bool firewall_enum(firewall_callback_t enum_callback);
+
+/**
+ * Starts watching the rule stores for changes. Returns false if they
+ * cannot be watched.
+ */
+bool firewall_watch(firewall_change_t change_callback);
+
+/**
+ * Stops watching the rule stores. Waits until the change callback has returned.
  */
-void firewall_enum(firewall_callback_t enum_callback);
+void firewall_unwatch(void);
 
 /**
  * Returns true if the firewall is filtering outbound connections, false otherwise.
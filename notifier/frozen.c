@@ -0,0 +1,533 @@
+#include "frozen.h"
+#include "memory.h"
+#include "platform.h"
+#include <string.h>
+
+/**
+ * Average number of keys per bucket. Larger buckets make the index smaller
+ * and the build slower.
+ */
+#define FROZEN_BUCKET_KEYS 2
+
+/**
+ * Pilots tried per bucket before the build gives up.
+ */
+#define FROZEN_MAX_PILOT 0x1000000
+
+/**
+ * Pilot flag of a single key bucket, the rest of the pilot is its slot.
+ * Those are placed last, straight into any free slot.
+ */
+#define FROZEN_DIRECT 0x80000000u
+
+/**
+ * Identifies a saved index, "NFRZ" in little endian byte order.
+ */
+#define FROZEN_MAGIC 0x5A52464Eu
+
+/**
+ * Version of the saved index. Bumped whenever the layout, the placement of
+ * keys, the path hash or the case folding of the cache changes, older files
+ * are then rebuilt.
+ */
+#define FROZEN_VERSION 3
+
+/**
+ * Start of the data of an index, in memory as on disk. It is followed by
+ * the path hashes and offsets of the packed paths by slot, a pilot per
+ * bucket and the packed paths, then padding to a multiple of 8 bytes. The
+ * checksum covers everything after the header.
+ */
+struct frozen_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t char_size;
+	uint32_t reserved;
+	uint64_t count;
+	uint64_t buckets;
+	uint64_t chars;
+	uint64_t size;
+	uint64_t checksum;
+};
+
+/**
+ * Byte offsets of the arrays of an index from the start of its data, and
+ * the size of the data.
+ */
+struct frozen_layout {
+	uint64_t hashes;
+	uint64_t offsets;
+	uint64_t pilots;
+	uint64_t keys;
+	uint64_t keys_end;
+	uint64_t size;
+};
+
+/**
+ * Index handle. The data is allocated or mapped from a file, in which case
+ * it is read only. The removal marks always live in memory, one per slot.
+ */
+struct frozen {
+	struct frozen_header *header;
+	bool mapped;
+	size_t count;
+	size_t buckets;
+	uint64_t *hashes;
+	uint32_t *offsets;
+	uint32_t *pilots;
+	wchar_t *keys;
+	uint8_t *removed;
+};
+
+/**
+ * Maps a 64-bit value to [0, n) using its high bits.
+ */
+static size_t frozen_reduce(uint64_t x, size_t n) {
+	return (size_t)(((x >> 32) * (uint64_t)n) >> 32);
+}
+
+/**
+ * Returns the bucket of a hash.
+ */
+static size_t frozen_bucket(struct frozen const *f, uint64_t hash) {
+	return frozen_reduce(hash * 0x9E3779B97F4A7C15ULL, f->buckets);
+}
+
+/**
+ * Returns the slot a pilot moves a hash to.
+ */
+static size_t frozen_slot(size_t count, uint64_t hash, uint32_t pilot) {
+	if (pilot & FROZEN_DIRECT) {
+		return pilot & ~FROZEN_DIRECT;
+	}
+
+	uint64_t x = hash ^ ((uint64_t)pilot * 0xC2B2AE3D27D4EB4FULL);
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDULL;
+	x ^= x >> 33;
+
+	return frozen_reduce(x, count);
+}
+
+/**
+ * Returns true if a slot was taken by a placed key.
+ */
+static bool frozen_taken(uint64_t const *taken, size_t slot) {
+	return (taken[slot >> 6] >> (slot & 63)) & 1;
+}
+
+/**
+ * Flips whether a slot is taken.
+ */
+static void frozen_toggle(uint64_t *taken, size_t slot) {
+	taken[slot >> 6] ^= (uint64_t)1 << (slot & 63);
+}
+
+/**
+ * Rounds a byte offset up to the alignment of the following array.
+ */
+static uint64_t frozen_align(uint64_t offset, uint64_t alignment) {
+	return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+/**
+ * Lays out the data of an index of the given size.
+ */
+static void frozen_layout(uint64_t count, uint64_t buckets, uint64_t chars, struct frozen_layout *l) {
+	l->hashes = frozen_align(sizeof(struct frozen_header), sizeof(uint64_t));
+	l->offsets = l->hashes + sizeof(uint64_t) * count;
+	l->pilots = l->offsets + sizeof(uint32_t) * (count + 1);
+	l->keys = frozen_align(l->pilots + sizeof(uint32_t) * buckets, sizeof(wchar_t));
+	l->keys_end = l->keys + sizeof(wchar_t) * chars;
+	l->size = frozen_align(l->keys_end, sizeof(uint64_t));
+}
+
+/**
+ * Computes the checksum of the data following a header.
+ */
+static uint64_t frozen_sum(struct frozen_header const *header) {
+	uint64_t const *words = (uint64_t const*)(header + 1);
+	size_t count = (size_t)(header->size - sizeof(*header)) / sizeof(*words);
+	uint64_t h = header->count;
+
+	for (size_t i = 0; i < count; ++i) {
+		h ^= words[i] * 0x87C37B91114253D5ULL;
+		h = ((h << 31) | (h >> 33)) * 0x4CF5AD432745937FULL;
+	}
+
+	return h ^ (h >> 29);
+}
+
+/**
+ * Creates the handle of an index over its data.
+ */
+static struct frozen* frozen_attach(struct frozen_header *header, bool mapped) {
+	size_t count = (size_t)header->count;
+
+	uint8_t *block = memory_alloc(MEMORY_TAG_CACHE, sizeof(struct frozen) + count);
+	if (block == NULL) {
+		return NULL;
+	}
+
+	struct frozen_layout l;
+	frozen_layout(header->count, header->buckets, header->chars, &l);
+
+	uint8_t *data = (uint8_t*)header;
+	struct frozen *f = (struct frozen*)block;
+	f->header = header;
+	f->mapped = mapped;
+	f->count = count;
+	f->buckets = (size_t)header->buckets;
+	f->hashes = (uint64_t*)(data + l.hashes);
+	f->offsets = (uint32_t*)(data + l.offsets);
+	f->pilots = (uint32_t*)(data + l.pilots);
+	f->keys = (wchar_t*)(data + l.keys);
+	f->removed = block + sizeof(struct frozen);
+
+	return f;
+}
+
+/**
+ * Allocates an index of the given size, its arrays uninitialized.
+ */
+static struct frozen* frozen_create(size_t count, size_t buckets, size_t chars) {
+	struct frozen_layout l;
+	frozen_layout(count, buckets, chars, &l);
+
+	if (l.size > SIZE_MAX) {
+		return NULL;
+	}
+
+	uint8_t *data = memory_alloc_raw(MEMORY_TAG_CACHE, (size_t)l.size);
+	if (data == NULL) {
+		return NULL;
+	}
+
+	struct frozen_header *header = (struct frozen_header*)data;
+	memset(header, 0, sizeof(*header));
+	header->magic = FROZEN_MAGIC;
+	header->version = FROZEN_VERSION;
+	header->char_size = sizeof(wchar_t);
+	header->count = count;
+	header->buckets = buckets;
+	header->chars = chars;
+	header->size = l.size;
+
+	/* Padding is zeroed so equal indexes have equal checksums. */
+	memset(data + sizeof(*header), 0, (size_t)(l.hashes - sizeof(*header)));
+	memset(data + l.pilots + sizeof(uint32_t) * buckets, 0, (size_t)(l.keys - l.pilots - sizeof(uint32_t) * buckets));
+	memset(data + l.keys_end, 0, (size_t)(l.size - l.keys_end));
+
+	struct frozen *f = frozen_attach(header, false);
+	if (f == NULL) {
+		memory_free(data);
+	}
+
+	return f;
+}
+
+/**
+ * Finds a pilot placing every key of a bucket in a free slot, marks the
+ * slots taken and records the slot of each key. Returns false if there is
+ * none, or two keys of the bucket share their hash.
+ */
+static bool frozen_place(struct frozen *f, struct frozen_key const *keys, uint32_t const *members, size_t size, uint64_t *taken, uint32_t *slots, uint32_t *key_slots) {
+	for (size_t i = 0; i < size; ++i) {
+		for (size_t j = 0; j < i; ++j) {
+			if (keys[members[i]].hash == keys[members[j]].hash) {
+				return false;
+			}
+		}
+	}
+
+	for (uint32_t pilot = 0; pilot < FROZEN_MAX_PILOT; ++pilot) {
+		size_t placed = 0;
+
+		for (; placed < size; ++placed) {
+			size_t slot = frozen_slot(f->count, keys[members[placed]].hash, pilot);
+			if (frozen_taken(taken, slot)) {
+				break;
+			}
+
+			/* Claimed right away so keys of the bucket do not collide either. */
+			frozen_toggle(taken, slot);
+			slots[placed] = (uint32_t)slot;
+		}
+
+		if (placed == size) {
+			for (size_t i = 0; i < size; ++i) {
+				key_slots[members[i]] = slots[i];
+			}
+
+			f->pilots[frozen_bucket(f, keys[members[0]].hash)] = pilot;
+			return true;
+		}
+
+		while (placed-- > 0) {
+			frozen_toggle(taken, slots[placed]);
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Assigns every key a slot, largest buckets first.
+ */
+static bool frozen_assign(struct frozen *f, struct frozen_key const *keys, uint32_t *key_slots) {
+	size_t count = f->count;
+	size_t buckets = f->buckets;
+
+	/* Keys grouped by bucket, and buckets ordered by size. Indices fit 32
+	 * bits since the slot of a pilot does. */
+	uint32_t *starts = MEMORY_ALLOC_COUNT(MEMORY_TAG_GENERAL, starts, buckets + 1);
+	uint32_t *members = MEMORY_ALLOC_COUNT(MEMORY_TAG_GENERAL, members, count);
+	uint32_t *order = MEMORY_ALLOC_COUNT(MEMORY_TAG_GENERAL, order, buckets);
+	uint32_t *sizes = MEMORY_ALLOC_COUNT(MEMORY_TAG_GENERAL, sizes, count + 2);
+	uint64_t *taken = MEMORY_ALLOC_COUNT(MEMORY_TAG_GENERAL, taken, count / 64 + 1);
+	bool result = false;
+
+	if (starts && members && order && sizes && taken) {
+		/* The bucket of each key is kept in its slot until the key is placed. */
+		for (size_t i = 0; i < count; ++i) {
+			key_slots[i] = (uint32_t)frozen_bucket(f, keys[i].hash);
+			starts[key_slots[i] + 1] += 1;
+		}
+
+		size_t largest = 0;
+		for (size_t b = 0; b < buckets; ++b) {
+			size_t size = starts[b + 1];
+			largest = size > largest ? size : largest;
+			sizes[size + 1] += 1;
+			starts[b + 1] += starts[b];
+		}
+
+		for (size_t i = 0; i < count; ++i) {
+			members[starts[key_slots[i]]++] = (uint32_t)i;
+		}
+
+		/* Placing moved each start to the next bucket, move them back. */
+		for (size_t b = buckets; b > 0; --b) {
+			starts[b] = starts[b - 1];
+		}
+		starts[0] = 0;
+
+		for (size_t size = 0; size <= largest; ++size) {
+			sizes[size + 1] += sizes[size];
+		}
+
+		/* Counting sort by size, then walked backwards for largest first. */
+		for (size_t b = 0; b < buckets; ++b) {
+			order[sizes[starts[b + 1] - starts[b]]++] = (uint32_t)b;
+		}
+
+		uint32_t *slots = MEMORY_ALLOC_COUNT(MEMORY_TAG_GENERAL, slots, largest);
+		size_t next_free = 0;
+		result = slots != NULL;
+
+		for (size_t i = buckets; result && i > 0; --i) {
+			size_t b = order[i - 1];
+			size_t size = starts[b + 1] - starts[b];
+
+			if (size == 0) {
+				f->pilots[b] = 0;
+			} else if (size == 1) {
+				while (frozen_taken(taken, next_free)) {
+					++next_free;
+				}
+
+				frozen_toggle(taken, next_free);
+				key_slots[members[starts[b]]] = (uint32_t)next_free;
+				f->pilots[b] = FROZEN_DIRECT | (uint32_t)next_free;
+			} else {
+				result = frozen_place(f, keys, &members[starts[b]], size, taken, slots, key_slots);
+			}
+		}
+
+		memory_free(slots);
+	}
+
+	memory_free(taken);
+	memory_free(sizes);
+	memory_free(order);
+	memory_free(members);
+	memory_free(starts);
+
+	return result;
+}
+
+struct frozen* frozen_build(struct frozen_key const *keys, size_t count) {
+	if (keys == NULL || count == 0 || count >= FROZEN_DIRECT) {
+		return NULL;
+	}
+
+	uint64_t chars = 0;
+	for (size_t i = 0; i < count; ++i) {
+		chars += (uint64_t)keys[i].len + 1;
+	}
+
+	if (chars > UINT32_MAX) {
+		return NULL;
+	}
+
+	struct frozen *f = frozen_create(count, count / FROZEN_BUCKET_KEYS + 1, (size_t)chars);
+	uint32_t *key_slots = MEMORY_ALLOC_COUNT(MEMORY_TAG_GENERAL, key_slots, count);
+
+	if (f == NULL || key_slots == NULL || frozen_assign(f, keys, key_slots) == false) {
+		memory_free(key_slots);
+		frozen_destroy(f);
+		return NULL;
+	}
+
+	/* Pack the paths in slot order, the offsets first hold their sizes. */
+	memset(f->offsets, 0, sizeof(*f->offsets) * (count + 1));
+
+	for (size_t i = 0; i < count; ++i) {
+		f->hashes[key_slots[i]] = keys[i].hash;
+		f->offsets[key_slots[i] + 1] = keys[i].len + 1;
+	}
+
+	for (size_t slot = 0; slot < count; ++slot) {
+		f->offsets[slot + 1] += f->offsets[slot];
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		wchar_t *key = f->keys + f->offsets[key_slots[i]];
+		memcpy(key, keys[i].path, sizeof(*key) * keys[i].len);
+		key[keys[i].len] = L'\0';
+	}
+
+	memory_free(key_slots);
+
+	f->header->checksum = frozen_sum(f->header);
+
+	return f;
+}
+
+/**
+ * Returns true if mapped data holds an index this build can use as is.
+ * Beyond the checksum, the offsets and direct slots are checked to lie
+ * within the index so lookups stay in bounds.
+ */
+static bool frozen_valid(struct frozen_header const *header, size_t size) {
+	if (size < sizeof(*header) || header->magic != FROZEN_MAGIC || header->version != FROZEN_VERSION || header->char_size != sizeof(wchar_t)) {
+		return false;
+	}
+
+	if (header->count == 0 || header->count >= FROZEN_DIRECT || header->buckets == 0 || header->buckets > header->count + 1 || header->chars > UINT32_MAX) {
+		return false;
+	}
+
+	struct frozen_layout l;
+	frozen_layout(header->count, header->buckets, header->chars, &l);
+
+	if (header->size != size || l.size != size || frozen_sum(header) != header->checksum) {
+		return false;
+	}
+
+	uint8_t const *data = (uint8_t const*)header;
+	uint32_t const *offsets = (uint32_t const*)(data + l.offsets);
+	uint32_t const *pilots = (uint32_t const*)(data + l.pilots);
+
+	if (offsets[0] != 0 || offsets[header->count] != header->chars) {
+		return false;
+	}
+
+	for (size_t slot = 0; slot < header->count; ++slot) {
+		if (offsets[slot + 1] <= offsets[slot]) {
+			return false;
+		}
+	}
+
+	for (size_t b = 0; b < header->buckets; ++b) {
+		if ((pilots[b] & FROZEN_DIRECT) && (pilots[b] & ~FROZEN_DIRECT) >= header->count) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool frozen_save(struct frozen const *frozen, wchar_t const *path) {
+	return platform_replace_file(path, frozen->header, (size_t)frozen->header->size);
+}
+
+struct frozen* frozen_load(wchar_t const *path) {
+	size_t size = 0;
+	void const *data = platform_map_file(path, &size);
+	if (data == NULL) {
+		return NULL;
+	}
+
+	/* Never written through, the handle just does not tell mapped data apart. */
+	struct frozen_header *header = (struct frozen_header*)data;
+	struct frozen *f = frozen_valid(header, size) ? frozen_attach(header, true) : NULL;
+
+	if (f == NULL) {
+		platform_unmap_file(data, size);
+	}
+
+	return f;
+}
+
+bool frozen_saved(struct frozen const *frozen, wchar_t const *path) {
+	size_t size = 0;
+	struct frozen_header const *header = platform_map_file(path, &size);
+	if (header == NULL) {
+		return false;
+	}
+
+	/* Only the header is read, the checksum stands for the rest. */
+	bool saved = size == frozen->header->size && memcmp(header, frozen->header, sizeof(*header)) == 0;
+	platform_unmap_file(header, size);
+
+	return saved;
+}
+
+void frozen_destroy(struct frozen *frozen) {
+	if (frozen == NULL) {
+		return;
+	}
+
+	if (frozen->mapped) {
+		platform_unmap_file(frozen->header, (size_t)frozen->header->size);
+	} else {
+		memory_free(frozen->header);
+	}
+
+	memory_free(frozen);
+}
+
+size_t frozen_count(struct frozen const *frozen) {
+	return frozen ? frozen->count : 0;
+}
+
+size_t frozen_find(struct frozen const *frozen, uint64_t hash, wchar_t const *path, size_t len) {
+	size_t slot = frozen_slot(frozen->count, hash, frozen->pilots[frozen_bucket(frozen, hash)]);
+
+	/* The slot of a path not in the index holds some other path. */
+	if (frozen->hashes[slot] != hash) {
+		return SIZE_MAX;
+	}
+
+	uint32_t offset = frozen->offsets[slot];
+	if (frozen->offsets[slot + 1] - offset != len + 1 || memcmp(frozen->keys + offset, path, sizeof(*path) * len) != 0) {
+		return SIZE_MAX;
+	}
+
+	return slot;
+}
+
+void frozen_key(struct frozen const *frozen, size_t slot, struct frozen_key *key) {
+	key->hash = frozen->hashes[slot];
+	key->path = frozen->keys + frozen->offsets[slot];
+	key->len = frozen->offsets[slot + 1] - frozen->offsets[slot] - 1;
+}
+
+bool frozen_removed(struct frozen const *frozen, size_t slot) {
+	return frozen->removed[slot] != 0;
+}
+
+void frozen_set_removed(struct frozen *frozen, size_t slot, bool removed) {
+	frozen->removed[slot] = removed ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "types.h"
+
+/**
+ * An immutable set of paths indexed by a minimal perfect hash. The paths
+ * are packed one after the other in slot order, a lookup computes a single
+ * slot from the path hash and compares one key. Only the removal marks
+ * change after the index is built. An index can be saved to a file and
+ * mapped back from it as is.
+ */
+struct frozen;
+
+/**
+ * A path to build a frozen index from, with its hash and length.
+ */
+struct frozen_key {
+	uint64_t hash;
+	wchar_t const *path;
+	uint32_t len;
+};
+
+/**
+ * Builds a frozen index of distinct paths. Returns NULL on failure, eg. if
+ * there are no paths or two of them share a hash.
+ */
+struct frozen* frozen_build(struct frozen_key const *keys, size_t count);
+
+/**
+ * Writes a frozen index to a file, without its removal marks.
+ * Returns true on success.
+ */
+bool frozen_save(struct frozen const *frozen, wchar_t const *path);
+
+/**
+ * Returns true if a file holds a frozen index as saved by frozen_save, going
+ * by its checksum. Indexes of the same paths are laid out the same.
+ */
+bool frozen_saved(struct frozen const *frozen, wchar_t const *path);
+
+/**
+ * Maps a frozen index saved by frozen_save. Returns NULL if the file cannot
+ * be mapped, fails its checksum or was saved by an incompatible build.
+ * No path is marked removed.
+ */
+struct frozen* frozen_load(wchar_t const *path);
+
+/**
+ * Destroys a frozen index, unmapping its file if it was loaded.
+ */
+void frozen_destroy(struct frozen *frozen);
+
+/**
+ * Returns the number of paths in the index, removed ones included.
+ */
+size_t frozen_count(struct frozen const *frozen);
+
+/**
+ * Returns the slot holding the path, or SIZE_MAX if it is not present.
+ */
+size_t frozen_find(struct frozen const *frozen, uint64_t hash, wchar_t const *path, size_t len);
+
+/**
+ * Retrieves the path in a slot along with its hash and length.
+ */
+void frozen_key(struct frozen const *frozen, size_t slot, struct frozen_key *key);
+
+/**
+ * Returns true if the path in a slot was marked as removed.
+ */
+bool frozen_removed(struct frozen const *frozen, size_t slot);
+
+/**
+ * Marks the path in a slot as removed or present again. Lookups may run
+ * concurrently, only one thread may change the marks.
+ */
+void frozen_set_removed(struct frozen *frozen, size_t slot, bool removed);
@@ -1,104 +1,156 @@
-#include "cache.h"
 #include "config.h"
 #include "console.h"
+#include "engine.h"
 #include "firewall.h"
-#include "memory.h"
 #include "monitor.h"
 #include "notifier.h"
 #include "path.h"
-#include "queue.h"
+#include "platform.h"
 #include "wstr.h"
 #include <Windows.h>
 #include <CommCtrl.h>
 #include <objbase.h>
-#include <strsafe.h>
+#include <stdio.h>
+#include <wchar.h>
 
 /**
- * Global application state.
+ * Startup phases. Each is timed from the start of the application to when
+ * it finished, some run concurrently.
  */
-static struct {
-	CRITICAL_SECTION lock;
-	int64_t cache_time;
-	bool closed;
-} g;
+enum STARTUP_PHASE {
+	STARTUP_PHASE_SNAPSHOT,
+	STARTUP_PHASE_MONITOR,
+	STARTUP_PHASE_NOTIFIER,
+	STARTUP_PHASE_FIREWALL,
+	STARTUP_PHASE_CACHE,
+	STARTUP_PHASE_TOTAL,
+	STARTUP_PHASE_COUNT
+};
+
+static wchar_t const* const STARTUP_PHASE_NAMES[STARTUP_PHASE_COUNT] = {
+	L"snapshot",
+	L"monitor",
+	L"notifier",
+	L"firewall",
+	L"cache",
+	L"total",
+};
 
 /**
- * Handles an enumerated firewall rule.
+ * Startup state. Each phase is written by the thread running it, and read
+ * once every thread is done.
  */
-static void rule_enum(wchar_t const *drive_path) {
-	cache_insert(drive_path, g.cache_time);
-}
+static struct {
+	int64_t start;
+	int64_t done[STARTUP_PHASE_COUNT];
+	bool loaded;
+} startup;
 
 /**
- * Rebuilds the firewall block cache.
+ * Handles a console action.
  */
-static void build_cache(int64_t time) {
-	g.cache_time = time;
-	firewall_enum(rule_enum);
+static void console_event(enum CONSOLE_ACTION action) {
+	switch (action) {
+		case CONSOLE_ACTION_OPEN_RULES:
+		{
+			/* Invalidate current cache since the user is messing around with the firewall.
+			 * Only needed if the rule stores could not be watched. */
+			engine_invalidate();
+		} break;
+
+		case CONSOLE_ACTION_REBUILD_CACHE:
+		{
+			/* Do an explicit rebuild of the cache now. */
+			engine_rebuild();
+		} break;
+
+		case CONSOLE_ACTION_VOLUMES_CHANGED:
+		{
+			/* Drive letters may have moved, translate devices again. */
+			path_invalidate();
+		} break;
+	}
 }
 
 /**
- * Handles a dropped network event. May occur from multiple threads at
- * once so care is taken to avoid race conditions.
+ * Builds the path of the snapshot file and creates its folder.
+ * Returns false if there is no place for it.
  */
-static void drop_event(wchar_t const *dev_path) {
-	/* Fix the path name. */
-	EnterCriticalSection(&g.lock);
-
-	if (g.closed) {
-		LeaveCriticalSection(&g.lock);
-		return;
+static bool snapshot_path(wchar_t* path, size_t path_count) {
+	DWORD len = GetEnvironmentVariableW(L"LOCALAPPDATA", path, (DWORD)path_count);
+	if (len == 0 || len >= path_count || wstr_cat(path, path_count, L"\\") == false || wstr_cat(path, path_count, CACHE_FILE) == false) {
+		return false;
 	}
 
-	static wchar_t path[MAX_EXT_PATH];
-	if (devpath_to_dospath(path, ARRAYSIZE(path), dev_path) == false) {
-		LeaveCriticalSection(&g.lock);
-		return;
-	}
+	/* Cut off at the file name for the folder, which may exist already. */
+	wchar_t* name = wcsrchr(path, L'\\');
+	*name = L'\0';
+	bool created = CreateDirectoryW(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+	*name = L'\\';
 
-	wstr_lower(path);
+	return created;
+}
 
-	/* Update the cache if applicable, then search it for the given rule. */
-	int64_t now = GetTickCount64();
+/**
+ * Records the end of a startup phase.
+ */
+static void startup_phase(enum STARTUP_PHASE phase) {
+	startup.done[phase] = platform_time_ns() - startup.start;
+}
 
-	if (now - g.cache_time >= CACHE_AGE) {
-		cache_prune(now, CACHE_AGE);
-		build_cache(now);
-	}
+/**
+ * Writes the startup phase timings to the debugger output in debug builds.
+ */
+static void startup_report(void) {
+#ifdef _DEBUG
+	wchar_t line[256] = L"notifier startup (ms):";
+	size_t len = wcslen(line);
 
-	if (cache_contains(path) == false) {
-		wchar_t* dup = wstr_dup(path);
-		if (queue_enqueue(dup)) {
-			cache_insert(path, GetTickCount64());
+	for (size_t i = 0; i < STARTUP_PHASE_COUNT && len < ARRAYSIZE(line); ++i) {
+		int n = swprintf_s(line + len, ARRAYSIZE(line) - len, L" %ls %.1f", STARTUP_PHASE_NAMES[i], (double)startup.done[i] / 1e6);
+		if (n < 0) {
+			break;
 		}
+
+		len += (size_t)n;
 	}
 
-	LeaveCriticalSection(&g.lock);
+	wstr_cat(line, ARRAYSIZE(line), L"\n");
+	OutputDebugStringW(line);
+#endif
 }
 
 /**
- * Handles a console action.
+ * Rules thread. Sets up the firewall interface and the cache of its rules
+ * while the monitor is started, then starts the background refresher.
  */
-static void console_event(enum CONSOLE_ACTION action) {
-	switch (action) {
-		case CONSOLE_ACTION_OPEN_RULES:
-		{
-			/* Invalidate current cache since the user is messing around with the firewall. */
-			/* The cache itself will be updated next time a block event arrives. */
-			EnterCriticalSection(&g.lock);
-			g.cache_time = 0;
-			LeaveCriticalSection(&g.lock);
-		} break;
+static DWORD WINAPI rules_thread(LPVOID lp) {
+	UNREFERENCED_PARAMETER(lp);
 
-		case CONSOLE_ACTION_REBUILD_CACHE:
-		{
-			/* Do an explicit rebuild of the cache now. */
-			EnterCriticalSection(&g.lock);
-			cache_clear();
-			build_cache(GetTickCount64());
-			LeaveCriticalSection(&g.lock);
-		} break;
+	HRESULT com = CoInitializeEx(0, COINIT_MULTITHREADED);
+
+	firewall_create();
+
+	/* Initialize filtering immediately in case the user had turned it off. */
+	firewall_set_filtering(true);
+	startup_phase(STARTUP_PHASE_FIREWALL);
+
+	/* Watch before the first enumeration so no change slips in between.
+	 * With a snapshot from the last run the refresher enumerates the rules
+	 * in the background instead. */
+	engine_watch();
+	if (startup.loaded == false) {
+		engine_rebuild();
+	}
+
+	startup_phase(STARTUP_PHASE_CACHE);
+	engine_start();
+
+	if (SUCCEEDED(com)) {
+		CoUninitialize();
 	}
+
+	return 0;
 }
 
 /**
@@ -107,22 +159,7 @@ static void console_event(enum CONSOLE_ACTION action) {
 static DWORD WINAPI notifier_thread(LPVOID lp) {
 	UNREFERENCED_PARAMETER(lp);
 
-	while (g.closed == false) {
-		wchar_t* path = queue_dequeue();
-		if (path == NULL) {
-			break;
-		}
-
-		enum notify_action a = notifier_show(path);
-		if (a != NOTIFIER_ACTION_SKIP) {
-			if (firewall_add(path, path, a == NOTIFIER_ACTION_ALLOW)) {
-				EnterCriticalSection(&g.lock);
-				cache_insert(path, GetTickCount64());
-				LeaveCriticalSection(&g.lock);
-			}
-		}
-
-		memory_free(path);
+	while (engine_notify(true)) {
 	}
 
 	return 0;
@@ -145,39 +182,75 @@ int CALLBACK wWinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE prev, _In_ PWS
 	icex.dwICC = ICC_STANDARD_CLASSES | ICC_TAB_CLASSES | ICC_WIN95_CLASSES;
 	InitCommonControlsEx(&icex);
 
-	InitializeCriticalSection(&g.lock);
+	struct engine_hooks hooks = {0};
+	hooks.time = platform_time;
+	hooks.dospath = devpath_normalize;
+	hooks.rules_enum = firewall_enum;
+	hooks.rules_watch = firewall_watch;
+	hooks.rules_unwatch = firewall_unwatch;
+	hooks.rules_add = firewall_add;
+	hooks.notify = notifier_show;
 
-	queue_create();
-	HANDLE thread = CreateThread(0, 0, notifier_thread, 0, 0, 0);
-	if (thread) {
-		firewall_create();
-		notifier_create();
-		monitor_create();
+	struct path_resolvers resolvers = {0};
+	resolvers.dos_device = platform_dos_device;
+	resolvers.environment = platform_environment;
+	resolvers.long_name = platform_long_path;
+#if CACHE_FILE_IDS
+	resolvers.file_id = platform_file_id;
+#endif
 
-		/* Initialize filtering immediately in case the user had turned it off. */
-		firewall_set_filtering(true);
+	path_create(&resolvers);
+	engine_create(&hooks);
+	startup.start = platform_time_ns();
 
-		build_cache(GetTickCount64());
-		monitor_start(drop_event);
-		console_run(console_event);
+	/* A snapshot from the last run makes the cache ready right away. */
+	wchar_t cache_file[MAX_PATH];
+	startup.loaded = snapshot_path(cache_file, ARRAYSIZE(cache_file)) && engine_load(cache_file);
+	startup_phase(STARTUP_PHASE_SNAPSHOT);
+
+	/* The firewall and the rule cache take the longest, they are set up on
+	 * their own thread. Should it fail to start, they are set up in turn. */
+	HANDLE rules = CreateThread(0, 0, rules_thread, 0, 0, 0);
+
+	/* Monitor as early as possible, the engine holds the events arriving
+	 * before its cache is ready. */
+	monitor_create();
+	monitor_start(engine_drop_event);
+	startup_phase(STARTUP_PHASE_MONITOR);
 
-		g.closed = true;
-		monitor_stop();
+	notifier_create();
+	startup_phase(STARTUP_PHASE_NOTIFIER);
 
-		monitor_destroy();
-		notifier_destroy();
-		firewall_destroy();
-		cache_clear();
+	if (rules) {
+		WaitForSingleObject(rules, INFINITE);
+		CloseHandle(rules);
+	} else {
+		rules_thread(0);
 	}
 
-	queue_destroy();
+	startup_phase(STARTUP_PHASE_TOTAL);
+	startup_report();
+
+	/* Notifications are only shown once the notifier and firewall are set up. */
+	HANDLE thread = CreateThread(0, 0, notifier_thread, 0, 0, 0);
+	if (thread) {
+		console_run(console_event);
+	}
+
+	engine_close();
+	monitor_stop();
+
+	monitor_destroy();
+	notifier_destroy();
+	firewall_destroy();
 
 	if (thread) {
 		WaitForSingleObject(thread, INFINITE);
 	}
 
-	DeleteCriticalSection(&g.lock);
+	engine_destroy();
+	path_destroy();
 	CoUninitialize();
 
 	return 0;
-}
\ No newline at end of file
+}
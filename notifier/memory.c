@@ -1,12 +1,301 @@
 #include "memory.h"
-#include <Windows.h>
+#include "platform.h"
+#include <string.h>
 
-void* memory_alloc(size_t bytes) {
-	return bytes ? HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, bytes) : NULL;
+/**
+ * Block sizes of the size class pools, header included. Larger
+ * allocations go straight to the system.
+ */
+static uint32_t const CLASS_SIZES[] = {
+	32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
+
+#define CLASS_COUNT (sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]))
+
+/**
+ * Size class of allocations made directly from the system.
+ */
+#define CLASS_LARGE 0xFFFF
+
+/**
+ * The size of the slabs the pools carve blocks from, in bytes.
+ */
+#define SLAB_SIZE 65536
+
+/**
+ * Every allocation is prefixed with a header recording where it came from,
+ * padded to keep the returned region 16-byte aligned.
+ */
+struct header {
+	uint16_t size_class;
+	uint16_t tag;
+	uint32_t reserved;
+	size_t bytes;
+};
+
+/**
+ * A free block, linked through its first bytes.
+ */
+struct block {
+	struct block* next;
+};
+
+/**
+ * Size class pool. Blocks are taken from the free list first, then carved
+ * from the current slab. Slabs are kept for the lifetime of the process, a
+ * freed block only goes back to the free list of its pool.
+ */
+struct pool {
+	int64_t volatile lock;
+	struct block* free;
+	uint8_t* slab;
+	size_t slab_used;
+	uint8_t padding[32];
+};
+
+/**
+ * Per subsystem counters.
+ */
+struct counters {
+	int64_t volatile allocs;
+	int64_t volatile frees;
+	int64_t volatile live_bytes;
+	int64_t volatile peak_bytes;
+};
+
+static struct {
+	struct pool pools[CLASS_COUNT];
+	struct counters tags[MEMORY_TAG_COUNT];
+	struct counters total;
+	int64_t volatile pool_bytes;
+} g;
+
+/**
+ * Acquires a pool lock. Held only for a few instructions, so spinning
+ * beats a kernel wait, and it needs no initialization.
+ */
+static void pool_lock(struct pool* p) {
+	for (unsigned spins = 0; platform_atomic_cas(&p->lock, 0, 1) != 0; ++spins) {
+		if (spins >= 64) {
+			platform_sleep(0);
+		}
+	}
+}
+
+static void pool_unlock(struct pool* p) {
+	platform_atomic_cas(&p->lock, 1, 0);
+}
+
+/**
+ * Returns the size class for a block size, or CLASS_LARGE.
+ */
+static size_t size_class(size_t size) {
+	for (size_t i = 0; i < CLASS_COUNT; ++i) {
+		if (size <= CLASS_SIZES[i]) {
+			return i;
+		}
+	}
+
+	return CLASS_LARGE;
+}
+
+/**
+ * Takes a block from a size class pool.
+ */
+static void* pool_take(size_t index) {
+	struct pool* p = &g.pools[index];
+	size_t size = CLASS_SIZES[index];
+	void* ptr = NULL;
+
+	pool_lock(p);
+
+	if (p->free) {
+		ptr = p->free;
+		p->free = p->free->next;
+	} else {
+		if (p->slab == NULL || p->slab_used + size > SLAB_SIZE) {
+			uint8_t* slab = platform_alloc(SLAB_SIZE);
+			if (slab) {
+				p->slab = slab;
+				p->slab_used = 0;
+				platform_atomic_add(&g.pool_bytes, SLAB_SIZE);
+			}
+		}
+
+		if (p->slab && p->slab_used + size <= SLAB_SIZE) {
+			ptr = p->slab + p->slab_used;
+			p->slab_used += size;
+		}
+	}
+
+	pool_unlock(p);
+
+	return ptr;
+}
+
+/**
+ * Returns a block to its size class pool.
+ */
+static void pool_give(size_t index, void* ptr) {
+	struct pool* p = &g.pools[index];
+	struct block* b = ptr;
+
+	pool_lock(p);
+	b->next = p->free;
+	p->free = b;
+	pool_unlock(p);
+}
+
+/**
+ * Raises a peak counter to at least the given value.
+ */
+static void raise_peak(int64_t volatile* peak, int64_t value) {
+	int64_t current = platform_atomic_load(peak);
+
+	while (value > current) {
+		int64_t prev = platform_atomic_cas(peak, current, value);
+		if (prev == current) {
+			break;
+		}
+
+		current = prev;
+	}
+}
+
+static void count_alloc(struct counters* c, int64_t bytes) {
+	platform_atomic_add(&c->allocs, 1);
+	raise_peak(&c->peak_bytes, platform_atomic_add(&c->live_bytes, bytes));
+}
+
+static void count_free(struct counters* c, int64_t bytes) {
+	platform_atomic_add(&c->frees, 1);
+	platform_atomic_add(&c->live_bytes, -bytes);
+}
+
+/**
+ * Allocates a region for a subsystem, zeroed if asked to. Large regions are
+ * zeroed by the system, which can hand out pages that are zero already.
+ */
+static void* allocate(enum MEMORY_TAG tag, size_t bytes, bool zero) {
+	if (bytes == 0 || bytes > SIZE_MAX - sizeof(struct header) || (unsigned)tag >= MEMORY_TAG_COUNT) {
+		return NULL;
+	}
+
+	size_t size = sizeof(struct header) + bytes;
+	size_t index = size_class(size);
+
+	struct header* h = NULL;
+	if (index == CLASS_LARGE) {
+		h = zero ? platform_alloc(size) : platform_alloc_raw(size);
+	} else {
+		h = pool_take(index);
+	}
+
+	if (h == NULL) {
+		return NULL;
+	}
+
+	h->size_class = (uint16_t)index;
+	h->tag = (uint16_t)tag;
+	h->bytes = bytes;
+
+	if (zero && index != CLASS_LARGE) {
+		memset(h + 1, 0, bytes);
+	}
+
+	count_alloc(&g.tags[tag], (int64_t)bytes);
+	count_alloc(&g.total, (int64_t)bytes);
+
+	return h + 1;
+}
+
+void* memory_alloc_raw(enum MEMORY_TAG tag, size_t bytes) {
+	return allocate(tag, bytes, false);
+}
+
+void* memory_alloc(enum MEMORY_TAG tag, size_t bytes) {
+	return allocate(tag, bytes, true);
 }
 
 void memory_free(void* ptr) {
-	if (ptr) {
-		HeapFree(GetProcessHeap(), 0, ptr);
+	if (ptr == NULL) {
+		return;
+	}
+
+	struct header* h = (struct header*)ptr - 1;
+
+	count_free(&g.tags[h->tag], (int64_t)h->bytes);
+	count_free(&g.total, (int64_t)h->bytes);
+
+	if (h->size_class == CLASS_LARGE) {
+		platform_free(h);
+	} else {
+		pool_give(h->size_class, h);
+	}
+}
+
+/**
+ * Copies a set of counters.
+ */
+static void read_counters(struct counters* c, struct memory_stats* stats) {
+	stats->allocs = platform_atomic_load(&c->allocs);
+	stats->frees = platform_atomic_load(&c->frees);
+	stats->live_bytes = platform_atomic_load(&c->live_bytes);
+	stats->peak_bytes = platform_atomic_load(&c->peak_bytes);
+}
+
+void memory_get_stats(enum MEMORY_TAG tag, struct memory_stats* stats) {
+	if (stats == NULL || (unsigned)tag >= MEMORY_TAG_COUNT) {
+		return;
+	}
+
+	read_counters(&g.tags[tag], stats);
+}
+
+void memory_get_total(struct memory_stats* stats) {
+	if (stats == NULL) {
+		return;
+	}
+
+	read_counters(&g.total, stats);
+}
+
+int64_t memory_pool_bytes(void) {
+	return platform_atomic_load(&g.pool_bytes);
+}
+
+/**
+ * Lowers a peak counter to the live byte count.
+ */
+static void reset_peak(struct counters* c) {
+	int64_t live = platform_atomic_load(&c->live_bytes);
+	int64_t peak = platform_atomic_load(&c->peak_bytes);
+
+	while (peak != live) {
+		int64_t prev = platform_atomic_cas(&c->peak_bytes, peak, live);
+		if (prev == peak) {
+			break;
+		}
+
+		peak = prev;
+	}
+}
+
+void memory_reset_peak(void) {
+	for (size_t i = 0; i < MEMORY_TAG_COUNT; ++i) {
+		reset_peak(&g.tags[i]);
+	}
+
+	reset_peak(&g.total);
+}
+
+char const* memory_tag_name(enum MEMORY_TAG tag) {
+	switch (tag) {
+		case MEMORY_TAG_GENERAL: return "general";
+		case MEMORY_TAG_CACHE: return "cache";
+		case MEMORY_TAG_QUEUE: return "queue";
+		case MEMORY_TAG_WSTR: return "wstr";
+		case MEMORY_TAG_RULES: return "rules";
+		default: return "unknown";
 	}
 }
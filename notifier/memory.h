@@ -4,17 +4,77 @@
 /**
  * Helping for allocating a given number of items of a certain type.
  */
-#define MEMORY_ALLOC_COUNT(dst, count) memory_alloc(sizeof(*(dst)) * count)
+#define MEMORY_ALLOC_COUNT(tag, dst, count) memory_alloc(tag, sizeof(*(dst)) * (count))
+
+/**
+ * Subsystems allocations are accounted to.
+ */
+enum MEMORY_TAG
+{
+	MEMORY_TAG_GENERAL,
+	MEMORY_TAG_CACHE,
+	MEMORY_TAG_QUEUE,
+	MEMORY_TAG_WSTR,
+	MEMORY_TAG_RULES,
+	MEMORY_TAG_COUNT
+};
+
+/**
+ * Allocation statistics, counted since the process started. The live bytes
+ * are those of regions not yet freed. Small regions come from pools that
+ * never return memory to the system, memory_pool_bytes tells how much they
+ * hold, so the process can hold more than the live bytes say.
+ */
+struct memory_stats {
+	int64_t allocs;
+	int64_t frees;
+	int64_t live_bytes;
+	int64_t peak_bytes;
+};
 
 /**
  * Allocates a region of memory with the size given in bytes.
  * The contents are guaranteed to be zero initialized.
  * Returns a pointer to the allocated region on success, NULL otherwise.
  */
-void* memory_alloc(size_t bytes);
+void* memory_alloc(enum MEMORY_TAG tag, size_t bytes);
+
+/**
+ * Allocates a region of memory with the size given in bytes.
+ * The contents are not initialized, for callers that overwrite them anyway.
+ * Returns a pointer to the allocated region on success, NULL otherwise.
+ */
+void* memory_alloc_raw(enum MEMORY_TAG tag, size_t bytes);
 
 /**
  * Frees a previously allocated region of memory.
  * If the pointer to the region is null no changes are made.
  */
 void memory_free(void* ptr);
+
+/**
+ * Retrieves the allocation statistics of a subsystem.
+ */
+void memory_get_stats(enum MEMORY_TAG tag, struct memory_stats* stats);
+
+/**
+ * Retrieves the allocation statistics summed over every subsystem.
+ */
+void memory_get_total(struct memory_stats* stats);
+
+/**
+ * Returns the number of bytes held by the size class pools, in use or not.
+ * It never shrinks, the pools keep their slabs for the lifetime of the
+ * process.
+ */
+int64_t memory_pool_bytes(void);
+
+/**
+ * Resets the peak byte counts to the current live byte counts.
+ */
+void memory_reset_peak(void);
+
+/**
+ * Returns the name of a subsystem, for reporting.
+ */
+char const* memory_tag_name(enum MEMORY_TAG tag);
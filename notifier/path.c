@@ -1,27 +1,701 @@
 #include "path.h"
-#include <Windows.h>
-#include <strsafe.h>
-#include <fltUser.h>
+#include "memory.h"
+#include "platform.h"
+#include "wstr.h"
+#include <string.h>
+#include <wchar.h>
 
-bool devpath_to_dospath(wchar_t * dos_path, size_t dos_path_count, wchar_t const * dev_path) {
+/**
+ * The maximum length of an NT device name, eg. \device\harddiskvolume1.
+ */
+#define DEVICE_NAME_SIZE 260
+
+/**
+ * Number of devices the prefix table remembers.
+ */
+#define PATH_DEVICES 32
+
+/**
+ * The longest device and DOS names the prefix table holds, null termination
+ * included. Devices with longer names are resolved on every call.
+ */
+#define PATH_DEVICE_NAME 64
+#define PATH_DOS_NAME 64
+
+/**
+ * Number of environment variables and of paths with short names the
+ * canonicalization remembers, the latter a power of two.
+ */
+#define PATH_VARIABLES 32
+#define PATH_LONG_NAMES 64
+
+/**
+ * The time (in milliseconds) a path whose long name or file identity could
+ * not be resolved is remembered as such before it is resolved again.
+ */
+#define PATH_RETRY 10000
+
+/**
+ * The longest variable name and value remembered, null termination
+ * included. Longer ones are left unexpanded.
+ */
+#define PATH_VARIABLE_NAME 64
+#define PATH_VARIABLE_VALUE 260
+
+/**
+ * Number of file identities remembered, a power of two, enough for every
+ * application with a rule and those running besides on a busy machine.
+ */
+#define PATH_IDS 4096
+
+/**
+ * The smallest path buffer of a remembered file identity, in characters.
+ */
+#define PATH_ID_NAME 64
+
+/**
+ * A resolved device, eg. \device\harddiskvolume1 mounted as C:.
+ */
+struct path_device {
+	wchar_t dev_name[PATH_DEVICE_NAME];
+	size_t dev_len;
+	wchar_t dos_name[PATH_DOS_NAME];
+};
+
+/**
+ * An environment variable, by its lowercase name. Unset variables are
+ * remembered too.
+ */
+struct path_variable {
+	wchar_t name[PATH_VARIABLE_NAME];
+	wchar_t value[PATH_VARIABLE_VALUE];
+	bool set;
+};
+
+/**
+ * A lowercase path holding short names and its long form, or none if it
+ * could not be resolved until the retry time (platform_time_ns). An entry
+ * without a short path is unused.
+ */
+struct path_long_name {
+	uint64_t hash;
+	wchar_t *short_path;
+	wchar_t *long_path;
+	int64_t retry;
+};
+
+/**
+ * The path buffer of a remembered file identity, followed by the path. A
+ * buffer outgrown by a longer path may still be read, so it is retired
+ * rather than freed until path_destroy.
+ */
+struct path_id_name {
+	struct path_id_name *retired;
+	size_t capacity;
+};
+
+/**
+ * The identity of the file at a lowercase path, if it has one, or when to
+ * try resolving it again if not. An empty path marks an unused entry.
+ * Readers take no lock, they retry if the sequence changed while they
+ * looked. A writer claims the entry by making the sequence odd, and skips
+ * it if another one got there first. Every field but the sequence is read
+ * and written with relaxed accesses.
+ */
+struct path_id {
+	int64_t volatile sequence;
+	uint64_t volatile hash;
+	size_t volatile len;
+	bool volatile found;
+	uint64_t volatile volume;
+	uint64_t volatile file;
+	int64_t volatile retry;
+	struct path_id_name *volatile name;
+};
+
+/**
+ * The prefix table of resolved devices. Readers take no lock, they retry if
+ * the sequence changed while they looked, which is odd while the table is
+ * written. Devices are only added past the count, which readers load
+ * relaxed. Writers hold the lock, as do users of the variables and long
+ * names, which only canonicalization needs.
+ */
+static struct {
+	struct path_resolvers resolvers;
+	platform_lock_t lock;
+	int64_t volatile sequence;
+	size_t volatile count;
+	struct path_device devices[PATH_DEVICES];
+	size_t variable_count;
+	struct path_variable variables[PATH_VARIABLES];
+	struct path_long_name long_names[PATH_LONG_NAMES];
+	struct path_id ids[PATH_IDS];
+	struct path_id_name *volatile retired;
+} g;
+
+/**
+ * Copies the DOS name of a device in the prefix table. Returns false if the
+ * device was not resolved yet.
+ */
+static bool path_lookup(wchar_t* dos_name, size_t dos_name_count, wchar_t const* dev_name, size_t dev_len) {
+	for (unsigned spins = 0;; ++spins) {
+		int64_t start = platform_atomic_load(&g.sequence);
+
+		if ((start & 1) == 0) {
+			bool found = false;
+			size_t count = PLATFORM_RELAXED_LOAD(&g.count);
+			if (count > PATH_DEVICES) {
+				count = PATH_DEVICES;
+			}
+
+			for (size_t i = 0; i < count && found == false; ++i) {
+				struct path_device const* d = &g.devices[i];
+				if (d->dev_len == dev_len && memcmp(d->dev_name, dev_name, sizeof(*dev_name) * dev_len) == 0) {
+					found = wstr_copy(dos_name, dos_name_count, d->dos_name);
+				}
+			}
+
+			platform_atomic_fence();
+			if (platform_atomic_load(&g.sequence) == start) {
+				return found;
+			}
+		}
+
+		if (spins >= 64) {
+			platform_sleep(0);
+		}
+	}
+}
+
+/**
+ * Resolves a device not in the prefix table and adds it, unless its names
+ * do not fit or the table is full. Failures are not remembered, a volume
+ * may not have its drive letter yet when it is first seen.
+ */
+static bool path_resolve(wchar_t* dos_name, size_t dos_name_count, wchar_t const* dev_name, size_t dev_len) {
+	platform_lock_enter(&g.lock);
+
+	/* Another thread may have resolved it while this one waited. */
+	bool resolved = path_lookup(dos_name, dos_name_count, dev_name, dev_len);
+
+	if (resolved == false) {
+		resolved = g.resolvers.dos_device(dos_name, dos_name_count, dev_name) && dos_name[0] != L'\0';
+
+		size_t dos_len = resolved ? wstr_len(dos_name, PATH_DOS_NAME) : PATH_DOS_NAME;
+		if (dos_len < PATH_DOS_NAME && dev_len < PATH_DEVICE_NAME && g.count < PATH_DEVICES) {
+			struct path_device* d = &g.devices[g.count];
+
+			platform_atomic_add(&g.sequence, 1);
+			memcpy(d->dev_name, dev_name, sizeof(*dev_name) * dev_len);
+			d->dev_name[dev_len] = L'\0';
+			d->dev_len = dev_len;
+			memcpy(d->dos_name, dos_name, sizeof(*dos_name) * (dos_len + 1));
+			PLATFORM_RELAXED_STORE(&g.count, g.count + 1);
+			platform_atomic_add(&g.sequence, 1);
+		}
+	}
+
+	platform_lock_leave(&g.lock);
+
+	return resolved;
+}
+
+/**
+ * Forgets the remembered variables, long names and file identities.
+ * Requires the lock.
+ */
+static void path_forget(void) {
+	for (size_t i = 0; i < PATH_LONG_NAMES; ++i) {
+		struct path_long_name* l = &g.long_names[i];
+
+		memory_free(l->short_path);
+		memory_free(l->long_path);
+		l->short_path = NULL;
+		l->long_path = NULL;
+	}
+
+	for (size_t i = 0; i < PATH_IDS; ++i) {
+		struct path_id* p = &g.ids[i];
+
+		/* Wait for a writer that claimed the entry. */
+		for (unsigned spins = 0;; ++spins) {
+			int64_t sequence = platform_atomic_load(&p->sequence);
+			if ((sequence & 1) == 0 && platform_atomic_cas(&p->sequence, sequence, sequence + 1) == sequence) {
+				break;
+			}
+
+			if (spins >= 64) {
+				platform_sleep(0);
+			}
+		}
+
+		PLATFORM_RELAXED_STORE(&p->len, 0);
+		platform_atomic_add(&p->sequence, 1);
+	}
+
+	g.variable_count = 0;
+}
+
+/**
+ * Copies the value of an environment variable, looking it up the first
+ * time it is asked for. Returns false if it is not set or does not fit.
+ */
+static bool path_variable(wchar_t* value, size_t value_count, wchar_t const* name, size_t name_len) {
+	wchar_t key[PATH_VARIABLE_NAME];
+	if (name_len >= PATH_VARIABLE_NAME || g.resolvers.environment == NULL) {
+		return false;
+	}
+
+	memcpy(key, name, sizeof(*name) * name_len);
+	key[name_len] = L'\0';
+	wstr_lower(key);
+
+	platform_lock_enter(&g.lock);
+
+	struct path_variable* v = NULL;
+	for (size_t i = 0; i < g.variable_count && v == NULL; ++i) {
+		if (wcscmp(g.variables[i].name, key) == 0) {
+			v = &g.variables[i];
+		}
+	}
+
+	if (v == NULL && g.variable_count < PATH_VARIABLES) {
+		v = &g.variables[g.variable_count++];
+		memcpy(v->name, key, sizeof(key));
+		v->set = g.resolvers.environment(v->value, PATH_VARIABLE_VALUE, key);
+	}
+
+	bool found = v && v->set && wstr_copy(value, value_count, v->value);
+
+	platform_lock_leave(&g.lock);
+
+	return found;
+}
+
+/**
+ * Copies a path expanding the environment variables in it, eg.
+ * %SystemRoot%. Variables that are not set are kept as they are, as
+ * Windows does. Returns the length of the result, or dest_count if it does
+ * not fit.
+ */
+static size_t path_expand(wchar_t* dest, size_t dest_count, wchar_t const* src) {
+	size_t len = 0;
+
+	while (*src) {
+		wchar_t const* end = src[0] == L'%' ? wcschr(src + 1, L'%') : NULL;
+
+		if (end && end > src + 1 && len < dest_count && path_variable(dest + len, dest_count - len, src + 1, (size_t)(end - src - 1))) {
+			len += wstr_len(dest + len, dest_count - len);
+			src = end + 1;
+			continue;
+		}
+
+		/* An unset variable is copied up to its closing %, which may open
+		 * the next one. */
+		size_t n = end ? (size_t)(end - src) : 1;
+		if (len + n >= dest_count) {
+			return dest_count;
+		}
+
+		memcpy(dest + len, src, sizeof(*src) * n);
+		len += n;
+		src += n;
+	}
+
+	if (len >= dest_count) {
+		return dest_count;
+	}
+
+	dest[len] = L'\0';
+	return len;
+}
+
+/**
+ * Returns true if a path starts with a prefix, ignoring ASCII case.
+ */
+static bool path_starts_with(wchar_t const* path, wchar_t const* prefix) {
+	for (; *prefix; ++path, ++prefix) {
+		wchar_t c = *path >= L'A' && *path <= L'Z' ? (wchar_t)(*path + 0x20) : *path;
+		if (c != *prefix) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Rewrites a path in place the way Windows parses it: forward slashes
+ * become backslashes, \\?\ style prefixes go, empty and . segments are
+ * dropped, .. drops the segment before it and segments lose trailing dots
+ * and spaces. Returns the new length.
+ */
+static size_t path_simplify(wchar_t* path, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		if (path[i] == L'/') {
+			path[i] = L'\\';
+		}
+	}
+
+	/* \\?\C:\x and \??\C:\x name C:\x, \\?\UNC\server\share names \\server\share. */
+	size_t r = 0;
+	size_t w = 0;
+
+	if (path_starts_with(path, L"\\\\?\\") || path_starts_with(path, L"\\??\\") || path_starts_with(path, L"\\\\.\\")) {
+		if (path_starts_with(path + 4, L"unc\\")) {
+			r = 6;
+			path[r] = L'\\';
+		} else {
+			r = 4;
+		}
+	}
+
+	/* The root is kept as is: a drive, a share or a leading backslash. */
+	size_t root = 0;
+
+	if (len - r >= 2 && path[r + 1] == L':') {
+		root = len - r > 2 && path[r + 2] == L'\\' ? 3 : 2;
+	} else if (len - r >= 2 && path[r] == L'\\' && path[r + 1] == L'\\') {
+		size_t separators = 0;
+		root = 2;
+		while (r + root < len && separators < 2) {
+			separators += path[r + root] == L'\\';
+			root += 1;
+		}
+	} else if (len - r >= 1 && path[r] == L'\\') {
+		root = 1;
+	}
+
+	memmove(path, path + r, sizeof(*path) * root);
+	r += root;
+	w = root;
+
+	while (r < len) {
+		size_t start = r;
+		while (r < len && path[r] != L'\\') {
+			++r;
+		}
+
+		size_t n = r - start;
+		r += 1;
+
+		if (n == 2 && path[start] == L'.' && path[start + 1] == L'.') {
+			while (w > root && path[w - 1] != L'\\') {
+				--w;
+			}
+			if (w > root) {
+				--w;
+			}
+			continue;
+		}
+
+		while (n > 0 && (path[start + n - 1] == L'.' || path[start + n - 1] == L' ')) {
+			--n;
+		}
+
+		if (n == 0) {
+			continue;
+		}
+
+		if (w > root) {
+			path[w++] = L'\\';
+		}
+
+		memmove(path + w, path + start, sizeof(*path) * n);
+		w += n;
+	}
+
+	path[w] = L'\0';
+	return w;
+}
+
+/**
+ * Replaces a lowercase path holding short names by its lowercase long form.
+ * Both outcomes of resolving a path are remembered, in an entry picked by
+ * its hash that evicts the path there before, and the system is only called
+ * outside the lock. A path that could not be resolved, eg. of a file that
+ * does not exist yet, is kept as it is and tried again after PATH_RETRY.
+ * Returns the new length.
+ */
+static size_t path_long_name(wchar_t* path, size_t path_count, size_t len) {
+	if (g.resolvers.long_name == NULL) {
+		return len;
+	}
+
+	uint64_t hash = wstr_hash_len(path, len);
+	struct path_long_name* l = &g.long_names[hash & (PATH_LONG_NAMES - 1)];
+	int64_t now = platform_time_ns();
+
+	platform_lock_enter(&g.lock);
+
+	bool known = l->short_path && l->hash == hash && wcscmp(l->short_path, path) == 0 && (l->long_path || now < l->retry);
+	if (known) {
+		size_t long_len = l->long_path ? wstr_len(l->long_path, path_count) : path_count;
+		if (long_len < path_count) {
+			memcpy(path, l->long_path, sizeof(*path) * (long_len + 1));
+			len = long_len;
+		}
+	}
+
+	platform_lock_leave(&g.lock);
+
+	if (known) {
+		return len;
+	}
+
+	wchar_t* resolved = memory_alloc_raw(MEMORY_TAG_WSTR, sizeof(*resolved) * path_count);
+	if (resolved == NULL) {
+		return len;
+	}
+
+	size_t long_len = g.resolvers.long_name(resolved, path_count, path) ? wstr_lower_copy(resolved, path_count, resolved) : path_count;
+
+	platform_lock_enter(&g.lock);
+
+	memory_free(l->short_path);
+	memory_free(l->long_path);
+	l->hash = hash;
+	l->short_path = wstr_dup(path);
+	l->long_path = long_len < path_count ? wstr_dup(resolved) : NULL;
+	l->retry = now + (int64_t)PATH_RETRY * 1000000;
+
+	/* A failed copy would pass for a path that could not be resolved. */
+	if (l->short_path == NULL || (l->long_path == NULL && long_len < path_count)) {
+		memory_free(l->short_path);
+		memory_free(l->long_path);
+		l->short_path = NULL;
+		l->long_path = NULL;
+	}
+
+	platform_lock_leave(&g.lock);
+
+	if (long_len < path_count) {
+		memcpy(path, resolved, sizeof(*path) * (long_len + 1));
+		len = long_len;
+	}
+
+	memory_free(resolved);
+
+	return len;
+}
+
+/**
+ * Returns the path following a path buffer header.
+ */
+static wchar_t volatile* path_id_chars(struct path_id_name* name) {
+	return (wchar_t volatile*)(name + 1);
+}
+
+/**
+ * Returns true if an entry holds the path, which a writer may be changing.
+ * The buffer is read within its own capacity, whichever entry it is from.
+ */
+static bool path_id_matches(struct path_id const* p, wchar_t const* path, size_t len, uint64_t hash) {
+	if (PLATFORM_RELAXED_LOAD(&p->hash) != hash || PLATFORM_RELAXED_LOAD(&p->len) != len) {
+		return false;
+	}
+
+	struct path_id_name* name = platform_atomic_load_ptr((void* volatile const*)&p->name);
+	if (name == NULL || len >= name->capacity) {
+		return false;
+	}
+
+	wchar_t volatile const* chars = path_id_chars(name);
+	for (size_t i = 0; i < len; ++i) {
+		if (PLATFORM_RELAXED_LOAD(&chars[i]) != path[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Copies the remembered identity of a path. Returns false if it is not
+ * remembered, or the file had none and is due to be resolved again, or a
+ * writer holds the entry. Sets found if the file has one.
+ */
+static bool path_id_lookup(struct path_id const* p, wchar_t const* path, size_t len, uint64_t hash, bool* found, uint64_t* volume, uint64_t* file) {
+	for (;;) {
+		int64_t start = platform_atomic_load(&p->sequence);
+		if (start & 1) {
+			return false;
+		}
+
+		bool known = path_id_matches(p, path, len, hash);
+		int64_t retry = PLATFORM_RELAXED_LOAD(&p->retry);
+		*found = PLATFORM_RELAXED_LOAD(&p->found);
+		*volume = PLATFORM_RELAXED_LOAD(&p->volume);
+		*file = PLATFORM_RELAXED_LOAD(&p->file);
+
+		platform_atomic_fence();
+		if (platform_atomic_load(&p->sequence) == start) {
+			return known && (*found || platform_time_ns() < retry);
+		}
+	}
+}
+
+/**
+ * Makes room for a path of the given length in a claimed entry, growing its
+ * buffer if needed. Returns false on failure.
+ */
+static bool path_id_reserve(struct path_id* p, size_t len) {
+	struct path_id_name* name = p->name;
+	if (name && len < name->capacity) {
+		return true;
+	}
+
+	size_t capacity = PATH_ID_NAME;
+	while (capacity <= len) {
+		capacity *= 2;
+	}
+
+	struct path_id_name* grown = memory_alloc_raw(MEMORY_TAG_WSTR, sizeof(*grown) + sizeof(wchar_t) * capacity);
+	if (grown == NULL) {
+		return false;
+	}
+
+	grown->retired = NULL;
+	grown->capacity = capacity;
+	platform_atomic_swap_ptr((void* volatile*)&p->name, grown);
+
+	if (name) {
+		name->retired = platform_atomic_swap_ptr((void* volatile*)&g.retired, name);
+	}
+
+	return true;
+}
+
+/**
+ * Remembers the identity of a path in its entry, replacing the one there,
+ * unless another thread is writing the entry. Takes no lock.
+ */
+static void path_id_store(struct path_id* p, wchar_t const* path, size_t len, uint64_t hash, bool found, uint64_t volume, uint64_t file) {
+	int64_t sequence = platform_atomic_load(&p->sequence);
+	if ((sequence & 1) || platform_atomic_cas(&p->sequence, sequence, sequence + 1) != sequence) {
+		return;
+	}
+
+	if (path_id_reserve(p, len)) {
+		wchar_t volatile* chars = path_id_chars(p->name);
+		for (size_t i = 0; i < len; ++i) {
+			PLATFORM_RELAXED_STORE(&chars[i], path[i]);
+		}
+
+		PLATFORM_RELAXED_STORE(&p->hash, hash);
+		PLATFORM_RELAXED_STORE(&p->len, len);
+		PLATFORM_RELAXED_STORE(&p->found, found);
+		PLATFORM_RELAXED_STORE(&p->volume, volume);
+		PLATFORM_RELAXED_STORE(&p->file, file);
+		PLATFORM_RELAXED_STORE(&p->retry, platform_time_ns() + (int64_t)PATH_RETRY * 1000000);
+	} else {
+		PLATFORM_RELAXED_STORE(&p->len, 0);
+	}
+
+	platform_atomic_add(&p->sequence, 1);
+}
+
+/**
+ * Writes the key of a file identity: a *, which no path starts with, then
+ * its 128 bits 14 at a time, each in a character never null or a surrogate.
+ */
+static void path_id_key(wchar_t* key, uint64_t volume, uint64_t file) {
+	key[0] = L'*';
+
+	for (unsigned i = 0; i < PATH_ID_KEY_LEN - 1; ++i) {
+		unsigned bit = 14 * i;
+		uint64_t bits = bit >= 64 ? file >> (bit - 64) : volume >> bit | (bit > 50 ? file << (64 - bit) : 0);
+
+		key[i + 1] = (wchar_t)(0x4000 | (bits & 0x3FFF));
+	}
+
+	key[PATH_ID_KEY_LEN] = L'\0';
+}
+
+void path_create(struct path_resolvers const* resolvers) {
+	g.resolvers = *resolvers;
+	g.sequence = 0;
+	g.count = 0;
+	g.variable_count = 0;
+
+	platform_lock_create(&g.lock);
+}
+
+void path_destroy(void) {
+	path_forget();
+	platform_lock_destroy(&g.lock);
+
+	for (size_t i = 0; i < PATH_IDS; ++i) {
+		memory_free(g.ids[i].name);
+		g.ids[i].name = NULL;
+	}
+
+	for (struct path_id_name *name = g.retired, *next; name; name = next) {
+		next = name->retired;
+		memory_free(name);
+	}
+
+	g.retired = NULL;
+
+	memset(&g.resolvers, 0, sizeof(g.resolvers));
+	g.count = 0;
+}
+
+void path_invalidate(void) {
+	if (g.resolvers.dos_device == NULL) {
+		return;
+	}
+
+	platform_lock_enter(&g.lock);
+	platform_atomic_add(&g.sequence, 1);
+	PLATFORM_RELAXED_STORE(&g.count, 0);
+	platform_atomic_add(&g.sequence, 1);
+	path_forget();
+	platform_lock_leave(&g.lock);
+}
+
+size_t path_canonicalize(wchar_t* dest, size_t dest_count, wchar_t const* src) {
+	if (dest == NULL || dest_count == 0 || src == NULL) {
+		return dest_count;
+	}
+
+	size_t len = path_expand(dest, dest_count, src);
+	if (len == dest_count) {
+		return dest_count;
+	}
+
+	len = path_simplify(dest, len);
+	wstr_lower(dest);
+
+	if (wmemchr(dest, L'~', len)) {
+		len = path_long_name(dest, dest_count, len);
+	}
+
+	return len;
+}
+
+bool devpath_normalize(wchar_t * dos_path, size_t dos_path_count, wchar_t const * dev_path, size_t * len, uint64_t * hash) {
 	/* Check parameters. */
-	if (dos_path == 0 || dos_path_count == 0 || dev_path == 0) {
-		return FALSE;
+	if (dos_path == 0 || dos_path_count == 0 || dev_path == 0 || len == 0 || hash == 0 || g.resolvers.dos_device == NULL) {
+		return false;
 	}
 
 	/* Device looks like: \\device\\harddiskvolume*\\, split on third backslash. */
-	wchar_t dev_name[MAX_PATH];
+	wchar_t dev_name[DEVICE_NAME_SIZE];
 	wchar_t const* s = dev_path;
-	wchar_t c;
 	size_t i = 0;
 	size_t n = 0;
 
-	while (i < ARRAYSIZE(dev_name)) {
-		c = *s;
+	for (;;) {
+		if (i == DEVICE_NAME_SIZE) {
+			return false;
+		}
+
+		wchar_t c = *s;
 		dev_name[i] = c;
 
-		if (s == 0) {
-			return FALSE;
+		if (c == 0) {
+			return false;
 		}
 
 		if (c == L'\\') {
@@ -36,11 +710,65 @@ bool devpath_to_dospath(wchar_t * dos_path, size_t dos_path_count, wchar_t const
 		++s;
 	}
 
-	/* After splitting we take the device name, translate it into a dos drive mount (eg. C:). */
-	if (FAILED(FilterGetDosName(dev_name, dos_path, (DWORD)dos_path_count)) || dos_path[0] == L'\0') {
-		return FALSE;
+	/* After splitting we take the device name, translate it into a dos drive mount (eg. C:).
+	 * Known devices are looked up in the prefix table, only new ones reach the system. */
+	if (path_lookup(dos_path, dos_path_count, dev_name, i) == false && path_resolve(dos_path, dos_path_count, dev_name, i) == false) {
+		return false;
+	}
+
+	/* And finally concatenate it all together: C: + filePath, folded on the
+	 * way, then hash the result. */
+	size_t drive = wstr_lower_copy(dos_path, dos_path_count, dos_path);
+	size_t rest = wstr_lower_copy(dos_path + drive, dos_path_count - drive, s);
+
+	if (rest == dos_path_count - drive) {
+		return false;
 	}
 
-	/* And finally concatenate it all together: C: + filePath */
-	return SUCCEEDED(StringCchCatW(dos_path, dos_path_count, s));
+	*len = drive + rest;
+
+	/* A program started by its short name is reported by it. */
+	if (wmemchr(dos_path, L'~', *len)) {
+		*len = path_long_name(dos_path, dos_path_count, *len);
+	}
+
+	*hash = wstr_hash_len(dos_path, *len);
+
+	return true;
+}
+
+bool path_identify(wchar_t* key, size_t key_count, wchar_t const* path, size_t len, uint64_t hash, size_t* key_len, uint64_t* key_hash) {
+	if (key == NULL || key_count <= PATH_ID_KEY_LEN || path == NULL || len == 0 || key_len == NULL || key_hash == NULL || g.resolvers.file_id == NULL) {
+		return false;
+	}
+
+	struct path_id* p = &g.ids[hash & (PATH_IDS - 1)];
+	bool found = false;
+	uint64_t volume = 0;
+	uint64_t file = 0;
+
+	/* Files without an identity are remembered for a while too, so events
+	 * of a missing file do not reach the system every time. */
+	if (path_id_lookup(p, path, len, hash, &found, &volume, &file) == false) {
+		found = g.resolvers.file_id(&volume, &file, path);
+		path_id_store(p, path, len, hash, found, volume, file);
+	}
+
+	if (found == false) {
+		return false;
+	}
+
+	path_id_key(key, volume, file);
+	*key_len = PATH_ID_KEY_LEN;
+	*key_hash = wstr_hash_len(key, PATH_ID_KEY_LEN);
+
+	return true;
+}
+
+bool path_identifies(void) {
+	return g.resolvers.file_id != NULL;
+}
+
+bool path_is_id_key(wchar_t const* key, size_t len) {
+	return key && len == PATH_ID_KEY_LEN && key[0] == L'*' && key[1] >= 0x4000 && key[1] <= 0x7FFF;
 }
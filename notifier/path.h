@@ -2,7 +2,106 @@
 #include "types.h"
 
 /**
- * Converts an NT device path to DOS path.
+ * Translates an NT device name (eg. \device\harddiskvolume1) into a DOS
+ * drive mount (eg. C:). Returns true on success.
+ */
+typedef bool (*path_resolver_t)(wchar_t* dos_name, size_t dos_name_count, wchar_t const* dev_name);
+
+/**
+ * Reads an environment variable by its lowercase name (eg. programfiles).
+ * Returns true if it is set and fits.
+ */
+typedef bool (*path_env_resolver_t)(wchar_t* value, size_t value_count, wchar_t const* name);
+
+/**
+ * Converts a lowercase path holding 8.3 short names (eg. c:\progra~1\app.exe)
+ * into its long form. Returns true on success.
+ */
+typedef bool (*path_name_resolver_t)(wchar_t* long_path, size_t long_path_count, wchar_t const* path);
+
+/**
+ * Reads the identity of the file at a lowercase path: the serial number of
+ * its volume and its file ID there. Returns true if the file exists.
+ */
+typedef bool (*path_id_resolver_t)(uint64_t* volume, uint64_t* file, wchar_t const* path);
+
+/**
+ * The system services path conversion depends on, eg. platform_dos_device,
+ * platform_environment, platform_long_path and platform_file_id. Replacing
+ * them allows paths to be converted against fakes. All but the device
+ * resolver are optional, without a file identity resolver no path has one.
+ */
+struct path_resolvers {
+	path_resolver_t dos_device;
+	path_env_resolver_t environment;
+	path_name_resolver_t long_name;
+	path_id_resolver_t file_id;
+};
+
+/**
+ * The length of the key path_identify writes, null termination not included.
+ */
+#define PATH_ID_KEY_LEN 11
+
+/**
+ * Sets up path conversion. Devices are translated the first time they are
+ * seen and then remembered in a prefix table, and so are the environment
+ * variables and short names canonicalization meets.
+ */
+void path_create(struct path_resolvers const* resolvers);
+
+/**
+ * Tears down path conversion. No other path functions may be running.
+ */
+void path_destroy(void);
+
+/**
+ * Forgets every translated device, eg. after a volume arrived or was
+ * removed, along with the remembered variables, short names and file
+ * identities. They are translated again when next seen.
+ */
+void path_invalidate(void);
+
+/**
+ * Converts an NT device path to a lowercase DOS path, computing its length
+ * and wstr_hash along the way. Short names are expanded as by
+ * path_canonicalize. May be called from any number of threads,
+ * known devices are looked up without a system call or lock.
  * Returns true if a valid conversion was available.
  */
-bool devpath_to_dospath(wchar_t* dos_path, size_t dos_path_count, wchar_t const* dev_path);
+bool devpath_normalize(wchar_t* dos_path, size_t dos_path_count, wchar_t const* dev_path, size_t* len, uint64_t* hash);
+
+/**
+ * Converts a path the way a firewall rule may name its application, eg.
+ * %ProgramFiles%\app\..\app.exe or \\?\C:\PROGRA~1\app.exe, to the
+ * lowercase DOS path devpath_normalize produces for the same file:
+ * environment variables are expanded, \\?\ prefixes and . and .. segments
+ * removed and short names expanded. dest may not be src. Returns the length
+ * of the result, or dest_count if it does not fit.
+ */
+size_t path_canonicalize(wchar_t* dest, size_t dest_count, wchar_t const* src);
+
+/**
+ * Writes the key of the file a lowercase path of known length and wstr_hash
+ * names, eg. as devpath_normalize produced it: a fixed width string no path
+ * is equal to, the same for every path naming the same file, eg. through a
+ * hard link. The key is null terminated and comes with its wstr_hash. The
+ * identities of recently seen paths are remembered and looked up without a
+ * system call or lock, paths without one are only resolved again after a
+ * while. May be called from any number of threads. Returns false if the
+ * file has no identity, eg. if it does not exist or there is no file
+ * identity resolver.
+ */
+bool path_identify(wchar_t* key, size_t key_count, wchar_t const* path, size_t len, uint64_t hash, size_t* key_len, uint64_t* key_hash);
+
+/**
+ * Returns true if there is a file identity resolver, so path_identify can
+ * find identities.
+ */
+bool path_identifies(void);
+
+/**
+ * Returns true if a string of known length is a key path_identify wrote
+ * rather than a path.
+ */
+bool path_is_id_key(wchar_t const* key, size_t len);
@@ -0,0 +1,211 @@
+#pragma once
+#include "types.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+
+typedef CRITICAL_SECTION platform_lock_t;
+typedef CONDITION_VARIABLE platform_cond_t;
+typedef HANDLE platform_thread_t;
+#else
+#include <pthread.h>
+
+typedef pthread_mutex_t platform_lock_t;
+typedef pthread_cond_t platform_cond_t;
+typedef pthread_t platform_thread_t;
+#endif
+
+/**
+ * Reads or writes a volatile variable of up to 8 bytes that other threads
+ * access at the same time, without ordering it against other accesses. For
+ * the fields seqlock readers look at, the sequence orders them.
+ */
+#if defined(_MSC_VER)
+#define PLATFORM_RELAXED_LOAD(ptr) (*(ptr))
+#define PLATFORM_RELAXED_STORE(ptr, value) (*(ptr) = (value))
+#else
+#define PLATFORM_RELAXED_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define PLATFORM_RELAXED_STORE(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELAXED)
+#endif
+
+/**
+ * Thread entry point.
+ */
+typedef void (*platform_thread_fn)(void* arg);
+
+/**
+ * Allocates a region of memory with the size given in bytes from the system.
+ * The contents are guaranteed to be zero initialized.
+ * Returns a pointer to the allocated region on success, NULL otherwise.
+ */
+void* platform_alloc(size_t bytes);
+
+/**
+ * Allocates a region of memory with the size given in bytes from the system.
+ * The contents are not initialized.
+ * Returns a pointer to the allocated region on success, NULL otherwise.
+ */
+void* platform_alloc_raw(size_t bytes);
+
+/**
+ * Frees a region of memory returned by platform_alloc or platform_alloc_raw.
+ * If the pointer to the region is null no changes are made.
+ */
+void platform_free(void* ptr);
+
+/**
+ * Creates a (recursive) mutual exclusion lock.
+ */
+void platform_lock_create(platform_lock_t* lock);
+
+/**
+ * Destroys a lock. The lock must not be held.
+ */
+void platform_lock_destroy(platform_lock_t* lock);
+
+/**
+ * Acquires a lock, waiting until it is available.
+ */
+void platform_lock_enter(platform_lock_t* lock);
+
+/**
+ * Releases a previously acquired lock.
+ */
+void platform_lock_leave(platform_lock_t* lock);
+
+/**
+ * Creates a condition variable.
+ */
+void platform_cond_create(platform_cond_t* cond);
+
+/**
+ * Destroys a condition variable. No threads may be waiting on it.
+ */
+void platform_cond_destroy(platform_cond_t* cond);
+
+/**
+ * Atomically releases the held lock and waits on the condition variable.
+ * The lock is reacquired before returning. Spurious wakeups are possible.
+ */
+void platform_cond_wait(platform_cond_t* cond, platform_lock_t* lock);
+
+/**
+ * Like platform_cond_wait, but gives up after the given number of
+ * milliseconds. Returns false if the wait timed out.
+ */
+bool platform_cond_wait_timeout(platform_cond_t* cond, platform_lock_t* lock, int64_t ms);
+
+/**
+ * Wakes a single thread waiting on the condition variable.
+ */
+void platform_cond_wake(platform_cond_t* cond);
+
+/**
+ * Wakes all threads waiting on the condition variable.
+ */
+void platform_cond_wake_all(platform_cond_t* cond);
+
+/**
+ * Starts a thread running the given function. Returns true on success.
+ */
+bool platform_thread_create(platform_thread_t* thread, platform_thread_fn fn, void* arg);
+
+/**
+ * Waits for a thread to finish and releases it.
+ */
+void platform_thread_join(platform_thread_t* thread);
+
+/**
+ * Returns an index below count for the calling thread, count being a power
+ * of two. Spreads per-thread state over stripes, threads may share one.
+ */
+size_t platform_thread_stripe(size_t count);
+
+/**
+ * Suspends the calling thread for at least the given number of milliseconds.
+ */
+void platform_sleep(int64_t ms);
+
+/**
+ * Returns the value of a monotonic clock, in milliseconds.
+ */
+int64_t platform_time(void);
+
+/**
+ * Returns the value of a high resolution monotonic clock, in nanoseconds.
+ */
+int64_t platform_time_ns(void);
+
+/**
+ * Atomically adds to a value. Returns the resulting value.
+ */
+int64_t platform_atomic_add(int64_t volatile* value, int64_t amount);
+
+/**
+ * Atomically replaces a value with desired if it equals expected.
+ * Returns the value held before the operation.
+ */
+int64_t platform_atomic_cas(int64_t volatile* value, int64_t expected, int64_t desired);
+
+/**
+ * Atomically reads a value.
+ */
+int64_t platform_atomic_load(int64_t volatile const* value);
+
+/**
+ * Issues a full memory barrier.
+ */
+void platform_atomic_fence(void);
+
+/**
+ * Atomically reads a pointer.
+ */
+void* platform_atomic_load_ptr(void* volatile const* ptr);
+
+/**
+ * Atomically replaces a pointer. Returns the pointer held before the operation.
+ */
+void* platform_atomic_swap_ptr(void* volatile* ptr, void* value);
+
+/**
+ * Translates an NT device name (eg. \device\harddiskvolume1) into
+ * a DOS drive mount (eg. C:). Returns true on success.
+ */
+bool platform_dos_device(wchar_t* dos_name, size_t dos_name_count, wchar_t const* dev_name);
+
+/**
+ * Reads an environment variable of the process (eg. ProgramFiles). Returns
+ * true if it is set and its value fits.
+ */
+bool platform_environment(wchar_t* value, size_t value_count, wchar_t const* name);
+
+/**
+ * Converts a path holding 8.3 short names (eg. c:\progra~1\app.exe) into
+ * its long form. The file must exist. Returns true on success.
+ */
+bool platform_long_path(wchar_t* long_path, size_t long_path_count, wchar_t const* path);
+
+/**
+ * Reads the identity of a file: the serial number of its volume and its
+ * file ID there, which hard links to it share. Returns true if the file
+ * exists.
+ */
+bool platform_file_id(uint64_t* volume, uint64_t* file, wchar_t const* path);
+
+/**
+ * Maps a file into memory read only. Returns its contents and stores their
+ * size, or returns NULL if the file cannot be mapped or is empty.
+ */
+void const* platform_map_file(wchar_t const* path, size_t* size);
+
+/**
+ * Unmaps a file mapped by platform_map_file.
+ */
+void platform_unmap_file(void const* data, size_t size);
+
+/**
+ * Replaces the contents of a file. The data is written to a temporary file
+ * next to it which then takes its place, so the file holds either the old or
+ * the new contents in full. Returns true on success.
+ */
+bool platform_replace_file(wchar_t const* path, void const* data, size_t size);
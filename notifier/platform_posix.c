@@ -0,0 +1,315 @@
+#include "platform.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Thread start parameters, owned by the new thread.
+ */
+struct thread_start {
+	platform_thread_fn fn;
+	void* arg;
+};
+
+static void* thread_main(void* arg) {
+	struct thread_start start = *(struct thread_start*)arg;
+	platform_free(arg);
+
+	start.fn(start.arg);
+
+	return NULL;
+}
+
+void* platform_alloc(size_t bytes) {
+	return bytes ? calloc(1, bytes) : NULL;
+}
+
+void* platform_alloc_raw(size_t bytes) {
+	return bytes ? malloc(bytes) : NULL;
+}
+
+void platform_free(void* ptr) {
+	free(ptr);
+}
+
+void platform_lock_create(platform_lock_t* lock) {
+	/* Critical sections are recursive, match them. */
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+void platform_lock_destroy(platform_lock_t* lock) {
+	pthread_mutex_destroy(lock);
+}
+
+void platform_lock_enter(platform_lock_t* lock) {
+	pthread_mutex_lock(lock);
+}
+
+void platform_lock_leave(platform_lock_t* lock) {
+	pthread_mutex_unlock(lock);
+}
+
+void platform_cond_create(platform_cond_t* cond) {
+	/* Timed waits are measured against the monotonic clock. */
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+void platform_cond_destroy(platform_cond_t* cond) {
+	pthread_cond_destroy(cond);
+}
+
+void platform_cond_wait(platform_cond_t* cond, platform_lock_t* lock) {
+	pthread_cond_wait(cond, lock);
+}
+
+bool platform_cond_wait_timeout(platform_cond_t* cond, platform_lock_t* lock, int64_t ms) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	ms = ms > 0 ? ms : 0;
+	ts.tv_sec += (time_t)(ms / 1000);
+	ts.tv_nsec += (long)(ms % 1000) * 1000000;
+
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	return pthread_cond_timedwait(cond, lock, &ts) == 0;
+}
+
+void platform_cond_wake(platform_cond_t* cond) {
+	pthread_cond_signal(cond);
+}
+
+void platform_cond_wake_all(platform_cond_t* cond) {
+	pthread_cond_broadcast(cond);
+}
+
+bool platform_thread_create(platform_thread_t* thread, platform_thread_fn fn, void* arg) {
+	struct thread_start* start = platform_alloc(sizeof(*start));
+	if (start == NULL) {
+		return false;
+	}
+
+	start->fn = fn;
+	start->arg = arg;
+
+	if (pthread_create(thread, NULL, thread_main, start) != 0) {
+		platform_free(start);
+		return false;
+	}
+
+	return true;
+}
+
+void platform_thread_join(platform_thread_t* thread) {
+	pthread_join(*thread, NULL);
+}
+
+size_t platform_thread_stripe(size_t count) {
+	uint64_t id = (uint64_t)(uintptr_t)pthread_self();
+	return (size_t)((id * 0x9E3779B97F4A7C15ULL) >> 32) & (count - 1);
+}
+
+void platform_sleep(int64_t ms) {
+	struct timespec ts;
+	ts.tv_sec = (time_t)(ms / 1000);
+	ts.tv_nsec = (long)(ms % 1000) * 1000000;
+
+	while (nanosleep(&ts, &ts) != 0) {
+	}
+}
+
+int64_t platform_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int64_t platform_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int64_t platform_atomic_add(int64_t volatile* value, int64_t amount) {
+	return __atomic_add_fetch(value, amount, __ATOMIC_SEQ_CST);
+}
+
+int64_t platform_atomic_cas(int64_t volatile* value, int64_t expected, int64_t desired) {
+	__atomic_compare_exchange_n(value, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return expected;
+}
+
+int64_t platform_atomic_load(int64_t volatile const* value) {
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+void platform_atomic_fence(void) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void* platform_atomic_load_ptr(void* volatile const* ptr) {
+	return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+void* platform_atomic_swap_ptr(void* volatile* ptr, void* value) {
+	return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+bool platform_dos_device(wchar_t* dos_name, size_t dos_name_count, wchar_t const* dev_name) {
+	/* There are no NT device names outside of Windows. */
+	(void)dos_name;
+	(void)dos_name_count;
+	(void)dev_name;
+
+	return false;
+}
+
+bool platform_environment(wchar_t* value, size_t value_count, wchar_t const* name) {
+	char mb_name[256];
+	if (value == NULL || value_count == 0 || name == NULL) {
+		return false;
+	}
+
+	size_t len = wcstombs(mb_name, name, sizeof(mb_name));
+	if (len == (size_t)-1 || len >= sizeof(mb_name)) {
+		return false;
+	}
+
+	char const* mb_value = getenv(mb_name);
+	if (mb_value == NULL) {
+		return false;
+	}
+
+	len = mbstowcs(value, mb_value, value_count);
+	return len != (size_t)-1 && len < value_count;
+}
+
+bool platform_long_path(wchar_t* long_path, size_t long_path_count, wchar_t const* path) {
+	/* There are no short names outside of Windows. */
+	(void)long_path;
+	(void)long_path_count;
+	(void)path;
+
+	return false;
+}
+
+/**
+ * Converts a path to the multibyte form the system calls take, appending
+ * suffix. Returns false if it does not fit.
+ */
+static bool file_path(char* dest, size_t dest_count, wchar_t const* path, char const* suffix) {
+	size_t len = wcstombs(dest, path, dest_count);
+	if (len == (size_t)-1 || len >= dest_count || strlen(suffix) >= dest_count - len) {
+		return false;
+	}
+
+	strcpy(dest + len, suffix);
+	return true;
+}
+
+bool platform_file_id(uint64_t* volume, uint64_t* file, wchar_t const* path) {
+	char name[PATH_MAX];
+	if (volume == NULL || file == NULL || path == NULL || file_path(name, sizeof(name), path, "") == false) {
+		return false;
+	}
+
+	struct stat st;
+	if (stat(name, &st) != 0) {
+		return false;
+	}
+
+	*volume = (uint64_t)st.st_dev;
+	*file = (uint64_t)st.st_ino;
+
+	return true;
+}
+
+void const* platform_map_file(wchar_t const* path, size_t* size) {
+	char name[PATH_MAX];
+	if (file_path(name, sizeof(name), path, "") == false) {
+		return NULL;
+	}
+
+	int fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	void* data = NULL;
+	struct stat st;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX) {
+		data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			data = NULL;
+		} else {
+			*size = (size_t)st.st_size;
+		}
+	}
+
+	/* The mapping keeps the file alive on its own. */
+	close(fd);
+
+	return data;
+}
+
+void platform_unmap_file(void const* data, size_t size) {
+	if (data) {
+		munmap((void*)data, size);
+	}
+}
+
+bool platform_replace_file(wchar_t const* path, void const* data, size_t size) {
+	char name[PATH_MAX];
+	char temp[PATH_MAX];
+	if (file_path(name, sizeof(name), path, "") == false || file_path(temp, sizeof(temp), path, ".tmp") == false) {
+		return false;
+	}
+
+	int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+
+	uint8_t const* bytes = data;
+	bool written = true;
+
+	while (written && size > 0) {
+		ssize_t n = write(fd, bytes, size);
+		written = n > 0;
+		if (written) {
+			bytes += n;
+			size -= (size_t)n;
+		}
+	}
+
+	/* The contents must reach the disk before the rename makes them current. */
+	written = written && fsync(fd) == 0;
+	written = close(fd) == 0 && written;
+
+	if (written == false || rename(temp, name) != 0) {
+		unlink(temp);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,280 @@
+#include "platform.h"
+#include <fltUser.h>
+#include <string.h>
+
+/**
+ * Thread start parameters, owned by the new thread.
+ */
+struct thread_start {
+	platform_thread_fn fn;
+	void* arg;
+};
+
+static DWORD WINAPI thread_main(LPVOID lp) {
+	struct thread_start start = *(struct thread_start*)lp;
+	platform_free(lp);
+
+	start.fn(start.arg);
+
+	return 0;
+}
+
+void* platform_alloc(size_t bytes) {
+	return bytes ? HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, bytes) : NULL;
+}
+
+void* platform_alloc_raw(size_t bytes) {
+	return bytes ? HeapAlloc(GetProcessHeap(), 0, bytes) : NULL;
+}
+
+void platform_free(void* ptr) {
+	if (ptr) {
+		HeapFree(GetProcessHeap(), 0, ptr);
+	}
+}
+
+void platform_lock_create(platform_lock_t* lock) {
+	InitializeCriticalSection(lock);
+}
+
+void platform_lock_destroy(platform_lock_t* lock) {
+	DeleteCriticalSection(lock);
+}
+
+void platform_lock_enter(platform_lock_t* lock) {
+	EnterCriticalSection(lock);
+}
+
+void platform_lock_leave(platform_lock_t* lock) {
+	LeaveCriticalSection(lock);
+}
+
+void platform_cond_create(platform_cond_t* cond) {
+	InitializeConditionVariable(cond);
+}
+
+void platform_cond_destroy(platform_cond_t* cond) {
+	/* Windows condition variables have no resources to release. */
+	UNREFERENCED_PARAMETER(cond);
+}
+
+void platform_cond_wait(platform_cond_t* cond, platform_lock_t* lock) {
+	SleepConditionVariableCS(cond, lock, INFINITE);
+}
+
+bool platform_cond_wait_timeout(platform_cond_t* cond, platform_lock_t* lock, int64_t ms) {
+	DWORD timeout = ms <= 0 ? 0 : ms >= INFINITE ? INFINITE - 1 : (DWORD)ms;
+	return SleepConditionVariableCS(cond, lock, timeout) != FALSE;
+}
+
+void platform_cond_wake(platform_cond_t* cond) {
+	WakeConditionVariable(cond);
+}
+
+void platform_cond_wake_all(platform_cond_t* cond) {
+	WakeAllConditionVariable(cond);
+}
+
+bool platform_thread_create(platform_thread_t* thread, platform_thread_fn fn, void* arg) {
+	struct thread_start* start = platform_alloc(sizeof(*start));
+	if (start == NULL) {
+		return false;
+	}
+
+	start->fn = fn;
+	start->arg = arg;
+
+	*thread = CreateThread(NULL, 0, thread_main, start, 0, NULL);
+	if (*thread == NULL) {
+		platform_free(start);
+		return false;
+	}
+
+	return true;
+}
+
+void platform_thread_join(platform_thread_t* thread) {
+	WaitForSingleObject(*thread, INFINITE);
+	CloseHandle(*thread);
+	*thread = NULL;
+}
+
+size_t platform_thread_stripe(size_t count) {
+	uint64_t id = GetCurrentThreadId();
+	return (size_t)((id * 0x9E3779B97F4A7C15ULL) >> 32) & (count - 1);
+}
+
+void platform_sleep(int64_t ms) {
+	Sleep(ms > 0 ? (DWORD)ms : 0);
+}
+
+int64_t platform_time(void) {
+	return (int64_t)GetTickCount64();
+}
+
+int64_t platform_time_ns(void) {
+	static LARGE_INTEGER frequency;
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+
+	int64_t seconds = counter.QuadPart / frequency.QuadPart;
+	int64_t rest = counter.QuadPart % frequency.QuadPart;
+
+	return seconds * 1000000000 + rest * 1000000000 / frequency.QuadPart;
+}
+
+int64_t platform_atomic_add(int64_t volatile* value, int64_t amount) {
+	return InterlockedAdd64(value, amount);
+}
+
+int64_t platform_atomic_cas(int64_t volatile* value, int64_t expected, int64_t desired) {
+	return InterlockedCompareExchange64(value, desired, expected);
+}
+
+int64_t platform_atomic_load(int64_t volatile const* value) {
+	return InterlockedCompareExchange64((int64_t volatile*)value, 0, 0);
+}
+
+void platform_atomic_fence(void) {
+	MemoryBarrier();
+}
+
+void* platform_atomic_load_ptr(void* volatile const* ptr) {
+	return InterlockedCompareExchangePointer((void* volatile*)ptr, NULL, NULL);
+}
+
+void* platform_atomic_swap_ptr(void* volatile* ptr, void* value) {
+	return InterlockedExchangePointer(ptr, value);
+}
+
+bool platform_dos_device(wchar_t* dos_name, size_t dos_name_count, wchar_t const* dev_name) {
+	if (dos_name == NULL || dos_name_count == 0 || dev_name == NULL) {
+		return false;
+	}
+
+	return SUCCEEDED(FilterGetDosName(dev_name, dos_name, (DWORD)dos_name_count));
+}
+
+bool platform_environment(wchar_t* value, size_t value_count, wchar_t const* name) {
+	if (value == NULL || value_count == 0 || value_count > MAXDWORD || name == NULL) {
+		return false;
+	}
+
+	DWORD len = GetEnvironmentVariableW(name, value, (DWORD)value_count);
+	return len > 0 && len < value_count;
+}
+
+bool platform_long_path(wchar_t* long_path, size_t long_path_count, wchar_t const* path) {
+	if (long_path == NULL || long_path_count == 0 || long_path_count > MAXDWORD || path == NULL) {
+		return false;
+	}
+
+	DWORD len = GetLongPathNameW(path, long_path, (DWORD)long_path_count);
+	return len > 0 && len < long_path_count;
+}
+
+bool platform_file_id(uint64_t* volume, uint64_t* file, wchar_t const* path) {
+	if (volume == NULL || file == NULL || path == NULL) {
+		return false;
+	}
+
+	/* Only the attributes are read, the file stays free for everyone else. */
+	HANDLE handle = CreateFileW(path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	BY_HANDLE_FILE_INFORMATION info;
+	bool found = GetFileInformationByHandle(handle, &info) != FALSE;
+
+	if (found) {
+		*volume = info.dwVolumeSerialNumber;
+		*file = (uint64_t)info.nFileIndexHigh << 32 | info.nFileIndexLow;
+	}
+
+	CloseHandle(handle);
+
+	return found;
+}
+
+void const* platform_map_file(wchar_t const* path, size_t* size) {
+	HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+
+	void const* data = NULL;
+	LARGE_INTEGER file_size;
+
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 && (uint64_t)file_size.QuadPart <= SIZE_MAX) {
+		HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping) {
+			data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (data) {
+				*size = (size_t)file_size.QuadPart;
+			}
+
+			/* The view keeps the mapping and the file alive on its own. */
+			CloseHandle(mapping);
+		}
+	}
+
+	CloseHandle(file);
+
+	return data;
+}
+
+void platform_unmap_file(void const* data, size_t size) {
+	UNREFERENCED_PARAMETER(size);
+
+	if (data) {
+		UnmapViewOfFile(data);
+	}
+}
+
+bool platform_replace_file(wchar_t const* path, void const* data, size_t size) {
+	static wchar_t const suffix[] = L".tmp";
+
+	size_t len = wcslen(path);
+	wchar_t* temp = platform_alloc(sizeof(wchar_t) * (len + ARRAYSIZE(suffix)));
+	if (temp == NULL) {
+		return false;
+	}
+
+	memcpy(temp, path, sizeof(wchar_t) * len);
+	memcpy(temp + len, suffix, sizeof(suffix));
+
+	bool written = false;
+
+	HANDLE file = CreateFileW(temp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file != INVALID_HANDLE_VALUE) {
+		uint8_t const* bytes = data;
+		written = true;
+
+		while (written && size > 0) {
+			DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+			DWORD n = 0;
+
+			written = WriteFile(file, bytes, chunk, &n, NULL) && n > 0;
+			bytes += n;
+			size -= n;
+		}
+
+		/* The contents must reach the disk before the move makes them current. */
+		written = written && FlushFileBuffers(file);
+		CloseHandle(file);
+
+		written = written && MoveFileExW(temp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+		if (written == false) {
+			DeleteFileW(temp);
+		}
+	}
+
+	platform_free(temp);
+
+	return written;
+}
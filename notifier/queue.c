@@ -1,10 +1,12 @@
 #include "queue.h"
 #include "config.h"
-#include <Windows.h>
+#include "memory.h"
+#include "platform.h"
+#include <string.h>
 
 static struct {
-	CONDITION_VARIABLE not_empty;
-	CRITICAL_SECTION lock;
+	platform_cond_t not_empty;
+	platform_lock_t lock;
 	bool running;
 	uint32_t count;
 	uint32_t offset;
@@ -13,57 +15,115 @@ static struct {
 
 void queue_create(void) {
 	g.running = true;
-	InitializeConditionVariable(&g.not_empty);
-	InitializeCriticalSection(&g.lock);
+	platform_cond_create(&g.not_empty);
+	platform_lock_create(&g.lock);
+}
+
+/**
+ * Frees the paths still queued. Requires the lock to be held.
+ */
+static void queue_drain(void) {
+	while (g.count > 0) {
+		memory_free(g.items[g.offset]);
+		g.count -= 1;
+		g.offset = (g.offset + 1) % QUEUE_SIZE;
+	}
+}
+
+void queue_close(void) {
+	platform_lock_enter(&g.lock);
+	g.running = false;
+	queue_drain();
+	platform_lock_leave(&g.lock);
+
+	platform_cond_wake_all(&g.not_empty);
 }
 
 void queue_destroy(void) {
-	EnterCriticalSection(&g.lock);
+	platform_lock_enter(&g.lock);
 	g.running = false;
-	LeaveCriticalSection(&g.lock);
+	queue_drain();
+	platform_lock_leave(&g.lock);
 
-	WakeAllConditionVariable(&g.not_empty);
+	platform_cond_destroy(&g.not_empty);
+	platform_lock_destroy(&g.lock);
 }
 
-bool queue_enqueue(wchar_t* path) {
-	EnterCriticalSection(&g.lock);
+bool queue_enqueue(wchar_t const* path, size_t len) {
+	size_t count = len + 1;
+	if (path == NULL || count > MAX_EXT_PATH) {
+		return false;
+	}
 
-	if (g.count >= QUEUE_SIZE || g.running == false) {
-		LeaveCriticalSection(&g.lock);
+	platform_lock_enter(&g.lock);
+
+	/* Only copy once there is room, a full queue costs nothing. */
+	wchar_t* copy = NULL;
+	if (g.count < QUEUE_SIZE && g.running == true) {
+		copy = memory_alloc_raw(MEMORY_TAG_QUEUE, sizeof(*copy) * count);
+	}
+
+	if (copy == NULL) {
+		platform_lock_leave(&g.lock);
 		return false;
 	}
 
-	g.items[(g.offset + g.count) % QUEUE_SIZE] = path;
+	memcpy(copy, path, sizeof(*copy) * len);
+	copy[len] = L'\0';
+	g.items[(g.offset + g.count) % QUEUE_SIZE] = copy;
 	g.count += 1;
 
-	LeaveCriticalSection(&g.lock);
-	WakeConditionVariable(&g.not_empty);
+	platform_lock_leave(&g.lock);
+	platform_cond_wake(&g.not_empty);
 
 	return true;
 }
 
+/**
+ * Removes the path at the front of the queue. Requires the lock to be held
+ * and the queue to contain an item.
+ */
+static wchar_t* queue_pop(void) {
+	wchar_t* path = g.items[g.offset];
+
+	g.count -= 1;
+	g.offset += 1;
+
+	if (g.offset == QUEUE_SIZE) {
+		g.offset = 0;
+	}
+
+	return path;
+}
+
 wchar_t* queue_dequeue(void) {
-	EnterCriticalSection(&g.lock);
+	platform_lock_enter(&g.lock);
 
 	while (g.count == 0 && g.running == true) {
-		SleepConditionVariableCS(&g.not_empty, &g.lock, INFINITE);
+		platform_cond_wait(&g.not_empty, &g.lock);
 	}
 
 	if (g.running == false) {
-		LeaveCriticalSection(&g.lock);
+		platform_lock_leave(&g.lock);
 		return NULL;
 	}
 
-	wchar_t* path = g.items[g.offset];
+	wchar_t* path = queue_pop();
 
-	g.count -= 1;
-	g.offset += 1;
+	platform_lock_leave(&g.lock);
 
-	if (g.offset == QUEUE_SIZE) {
-		g.offset = 0;
+	return path;
+}
+
+wchar_t* queue_try_dequeue(void) {
+	platform_lock_enter(&g.lock);
+
+	wchar_t* path = NULL;
+	if (g.count > 0 && g.running == true) {
+		path = queue_pop();
 	}
 
-	LeaveCriticalSection(&g.lock);
+	platform_lock_leave(&g.lock);
 
 	return path;
 }
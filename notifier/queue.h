@@ -7,20 +7,36 @@
 void queue_create(void);
 
 /**
- * Destroys the queue.
+ * Stops accepting paths, frees any still queued and releases the threads
+ * waiting in queue_dequeue.
+ */
+void queue_close(void);
+
+/**
+ * Destroys the queue, freeing any paths still queued. No thread may be
+ * waiting in queue_dequeue, close the queue and let them return first.
  */
 void queue_destroy(void);
 
 /**
- * Enqueues a path if the queue is not full.
- * Returns false if the queue is full.
+ * Enqueues a copy of a path of the given length if the queue is not full.
+ * Returns false if the queue is full or the copy failed.
  */
-bool queue_enqueue(wchar_t* path);
+bool queue_enqueue(wchar_t const* path, size_t len);
 
 /**
  * Dequeues a path. Waits until the queue contains an item or the
  * queue is no longer valid.
  *
- * Returns a pointer to the path if available, NULL otherwise.
+ * Returns a pointer to the path if available, NULL otherwise. The path
+ * must be freed with memory_free.
  */
 wchar_t* queue_dequeue(void);
+
+/**
+ * Dequeues a path without waiting.
+ *
+ * Returns a pointer to the path if available, NULL otherwise. The path
+ * must be freed with memory_free.
+ */
+wchar_t* queue_try_dequeue(void);
@@ -0,0 +1,396 @@
+#include "ruleset.h"
+#include "config.h"
+#include "memory.h"
+#include "path.h"
+#include "wstr.h"
+#include <string.h>
+#include <wchar.h>
+
+/**
+ * The initial number of buckets of a map, a power of two.
+ */
+#define RULESET_MIN_BUCKETS 256
+
+/**
+ * Map node header, embedded first in rules and covered paths.
+ */
+struct node {
+	struct node *next;
+	uint64_t key;
+};
+
+/**
+ * Chained hash map of nodes keyed by a 64-bit hash. Grows once there are
+ * as many nodes as buckets.
+ */
+struct map {
+	struct node **buckets;
+	size_t capacity;
+	size_t count;
+};
+
+/**
+ * A path covered by one or more rules, followed by the path itself.
+ */
+struct covered {
+	struct node node;
+	uint32_t refs;
+	uint32_t len;
+};
+
+/**
+ * A rule, keyed by the fingerprint of its properties. Two rules with equal
+ * fingerprints are treated as duplicates of each other. A rule covers its
+ * path, and the key of its file if that has an identity. Pending rules have
+ * a path that may not have been converted fully yet.
+ */
+struct rule {
+	struct node node;
+	uint64_t generation;
+	struct covered *covered;
+	struct covered *identity;
+	bool pending;
+};
+
+/**
+ * Rules of the last refresh and the paths they cover, identities among
+ * them, and room for the canonical path of a new rule and the key of its
+ * file.
+ */
+static struct {
+	struct map rules;
+	struct map paths;
+	size_t identities;
+	uint64_t generation;
+	size_t visited;
+	struct ruleset_stats stats;
+	wchar_t canonical[MAX_EXT_PATH];
+	wchar_t identity[PATH_ID_KEY_LEN + 1];
+} g;
+
+/**
+ * Returns the bucket of a key.
+ */
+static size_t map_bucket(struct map const *map, uint64_t key) {
+	return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (map->capacity - 1);
+}
+
+/**
+ * Returns the first node with the given key, NULL if there is none.
+ */
+static struct node* map_find(struct map const *map, uint64_t key) {
+	if (map->count == 0) {
+		return NULL;
+	}
+
+	struct node *node = map->buckets[map_bucket(map, key)];
+	while (node && node->key != key) {
+		node = node->next;
+	}
+
+	return node;
+}
+
+/**
+ * Inserts a node, growing the map if needed. The map keeps working at its
+ * current size if growing fails.
+ */
+static bool map_insert(struct map *map, struct node *node) {
+	if (map->count >= map->capacity) {
+		size_t capacity = map->capacity ? map->capacity * 2 : RULESET_MIN_BUCKETS;
+		struct node **buckets = MEMORY_ALLOC_COUNT(MEMORY_TAG_RULES, buckets, capacity);
+
+		if (buckets) {
+			struct map grown;
+			grown.buckets = buckets;
+			grown.capacity = capacity;
+			grown.count = map->count;
+
+			for (size_t i = 0; i < map->capacity; ++i) {
+				for (struct node *n = map->buckets[i], *next; n; n = next) {
+					next = n->next;
+
+					size_t b = map_bucket(&grown, n->key);
+					n->next = grown.buckets[b];
+					grown.buckets[b] = n;
+				}
+			}
+
+			memory_free(map->buckets);
+			*map = grown;
+		} else if (map->capacity == 0) {
+			return false;
+		}
+	}
+
+	size_t b = map_bucket(map, node->key);
+	node->next = map->buckets[b];
+	map->buckets[b] = node;
+	map->count += 1;
+
+	return true;
+}
+
+/**
+ * Unlinks a node from the map.
+ */
+static void map_remove(struct map *map, struct node *node) {
+	struct node **link = &map->buckets[map_bucket(map, node->key)];
+
+	while (*link != node) {
+		link = &(*link)->next;
+	}
+
+	*link = node->next;
+	map->count -= 1;
+}
+
+/**
+ * Frees every node and the buckets of a map.
+ */
+static void map_destroy(struct map *map) {
+	for (size_t i = 0; i < map->capacity; ++i) {
+		for (struct node *n = map->buckets[i], *next; n; n = next) {
+			next = n->next;
+			memory_free(n);
+		}
+	}
+
+	memory_free(map->buckets);
+	memset(map, 0, sizeof(*map));
+}
+
+/**
+ * Returns the path following a covered path header.
+ */
+static wchar_t* covered_path(struct covered *covered) {
+	return (wchar_t*)(covered + 1);
+}
+
+/**
+ * Takes a reference to a covered path, adding it if no rule covered it yet.
+ * Returns NULL on failure.
+ */
+static struct covered* path_acquire(wchar_t const *path, ruleset_delta_t added) {
+	size_t len = wstr_len(path, MAX_EXT_PATH);
+	if (len == 0 || len >= MAX_EXT_PATH) {
+		return NULL;
+	}
+
+	uint64_t hash = wstr_hash_len(path, len);
+
+	for (struct node *n = map_find(&g.paths, hash); n; n = n->next) {
+		struct covered *c = (struct covered*)n;
+
+		if (n->key == hash && c->len == len && memcmp(covered_path(c), path, sizeof(*path) * len) == 0) {
+			c->refs += 1;
+			return c;
+		}
+	}
+
+	struct covered *c = memory_alloc_raw(MEMORY_TAG_RULES, sizeof(*c) + sizeof(*path) * (len + 1));
+	if (c == NULL) {
+		return NULL;
+	}
+
+	c->node.key = hash;
+	c->refs = 1;
+	c->len = (uint32_t)len;
+	memcpy(covered_path(c), path, sizeof(*path) * (len + 1));
+
+	if (map_insert(&g.paths, &c->node) == false) {
+		memory_free(c);
+		return NULL;
+	}
+
+	if (path_is_id_key(path, len)) {
+		g.identities += 1;
+		g.stats.identities_added += 1;
+	} else {
+		g.stats.paths_added += 1;
+	}
+
+	added(covered_path(c));
+
+	return c;
+}
+
+/**
+ * Drops a reference to a covered path, removing it once no rule covers it.
+ */
+static void path_release(struct covered *c, ruleset_delta_t removed) {
+	if (c == NULL || --c->refs > 0) {
+		return;
+	}
+
+	map_remove(&g.paths, &c->node);
+
+	if (path_is_id_key(covered_path(c), c->len)) {
+		g.identities -= 1;
+		g.stats.identities_removed += 1;
+	} else {
+		g.stats.paths_removed += 1;
+	}
+
+	removed(covered_path(c));
+
+	memory_free(c);
+}
+
+/**
+ * Mixes a value into a fingerprint.
+ */
+static uint64_t fingerprint_mix(uint64_t hash, uint64_t value) {
+	return hash ^ (value + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2));
+}
+
+/**
+ * Returns the fingerprint of a rule's properties.
+ */
+static uint64_t ruleset_fingerprint(struct firewall_rule const *rule) {
+	uint64_t flags = (uint64_t)rule->outbound | (uint64_t)rule->enabled << 1 | (uint64_t)rule->allow << 2;
+
+	uint64_t hash = fingerprint_mix(0, wstr_hash(rule->name));
+	hash = fingerprint_mix(hash, wstr_hash(rule->path));
+	hash = fingerprint_mix(hash, wstr_hash(rule->ports));
+
+	return fingerprint_mix(hash, flags);
+}
+
+bool ruleset_covers(struct firewall_rule const *rule) {
+	if (rule == NULL || rule->outbound == false || rule->enabled == false) {
+		return false;
+	}
+
+	/* Allow rules only count if they cover every port. */
+	wchar_t const *ports = rule->ports;
+	return rule->allow == false || ports == NULL || (ports[0] == L'*' && ports[1] == L'\0');
+}
+
+void ruleset_begin(void) {
+	g.generation += 1;
+	g.visited = 0;
+}
+
+/**
+ * Converts the path of a rule to the forms the cache holds and covers them,
+ * in place of the ones it covered before. Paths the rule keeps covering are
+ * not reported.
+ */
+static void ruleset_resolve(struct rule *r, struct firewall_rule const *rule, ruleset_delta_t added, ruleset_delta_t removed) {
+	/* Rules name their application in any form Windows accepts, the cache
+	 * holds the one drop events report. */
+	size_t len = ruleset_covers(rule) ? path_canonicalize(g.canonical, MAX_EXT_PATH, rule->path) : MAX_EXT_PATH;
+	if (len == MAX_EXT_PATH) {
+		return;
+	}
+
+	struct covered *covered = path_acquire(g.canonical, added);
+	path_release(r->covered, removed);
+	r->covered = covered;
+
+	/* The path stays covered as well, for a file that does not exist yet
+	 * or is replaced by one with another identity. */
+	size_t key_len = 0;
+	uint64_t key_hash = 0;
+	struct covered *identity = NULL;
+
+	if (path_identify(g.identity, PATH_ID_KEY_LEN + 1, g.canonical, len, wstr_hash_len(g.canonical, len), &key_len, &key_hash)) {
+		identity = path_acquire(g.identity, added);
+	}
+
+	path_release(r->identity, removed);
+	r->identity = identity;
+
+	/* A short name left in the path did not resolve, or the file has no
+	 * identity, eg. as it does not exist yet. Either is tried again on the
+	 * next refresh. */
+	r->pending = wmemchr(g.canonical, L'~', len) != NULL || (identity == NULL && path_identifies());
+}
+
+void ruleset_visit(struct firewall_rule const *rule, ruleset_delta_t added, ruleset_delta_t removed) {
+	if (rule == NULL || added == NULL || removed == NULL) {
+		return;
+	}
+
+	uint64_t fingerprint = ruleset_fingerprint(rule);
+
+	struct rule *r = (struct rule*)map_find(&g.rules, fingerprint);
+	if (r) {
+		/* Unchanged since the last refresh, or a duplicate. */
+		if (r->generation != g.generation) {
+			r->generation = g.generation;
+			g.visited += 1;
+
+			if (r->pending) {
+				ruleset_resolve(r, rule, added, removed);
+			}
+		}
+
+		return;
+	}
+
+	r = memory_alloc_raw(MEMORY_TAG_RULES, sizeof(*r));
+	if (r == NULL) {
+		return;
+	}
+
+	r->node.key = fingerprint;
+	r->generation = g.generation;
+	r->covered = NULL;
+	r->identity = NULL;
+	r->pending = false;
+
+	if (map_insert(&g.rules, &r->node) == false) {
+		memory_free(r);
+		return;
+	}
+
+	g.visited += 1;
+	g.stats.rules_added += 1;
+
+	/* Only new and pending rules get here, so most forms are converted once. */
+	ruleset_resolve(r, rule, added, removed);
+}
+
+void ruleset_end(bool complete, ruleset_delta_t removed) {
+	g.stats.refreshes += 1;
+
+	/* Every known rule was seen again, nothing to remove. */
+	if (complete == false || removed == NULL || g.visited == g.rules.count) {
+		return;
+	}
+
+	for (size_t i = 0; i < g.rules.capacity; ++i) {
+		for (struct node *n = g.rules.buckets[i], *next; n; n = next) {
+			next = n->next;
+
+			struct rule *r = (struct rule*)n;
+			if (r->generation != g.generation) {
+				map_remove(&g.rules, n);
+				path_release(r->covered, removed);
+				path_release(r->identity, removed);
+				memory_free(r);
+
+				g.stats.rules_removed += 1;
+			}
+		}
+	}
+}
+
+void ruleset_clear(void) {
+	map_destroy(&g.rules);
+	map_destroy(&g.paths);
+	g.identities = 0;
+}
+
+void ruleset_get_stats(struct ruleset_stats *stats) {
+	if (stats == NULL) {
+		return;
+	}
+
+	*stats = g.stats;
+	stats->rules = (int64_t)g.rules.count;
+	stats->paths = (int64_t)(g.paths.count - g.identities);
+	stats->identities = (int64_t)g.identities;
+}
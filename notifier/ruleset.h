@@ -0,0 +1,66 @@
+#pragma once
+#include "firewall.h"
+#include "types.h"
+
+/**
+ * Receives a path whose coverage by firewall rules changed.
+ */
+typedef void (*ruleset_delta_t)(wchar_t const *path);
+
+/**
+ * Ruleset counters. Rule, path and identity counts describe the current
+ * rule set, the others accumulate over every refresh. Paths and identities
+ * count the covered paths and path_identify keys apart.
+ */
+struct ruleset_stats {
+	int64_t rules;
+	int64_t paths;
+	int64_t identities;
+	int64_t refreshes;
+	int64_t rules_added;
+	int64_t rules_removed;
+	int64_t paths_added;
+	int64_t paths_removed;
+	int64_t identities_added;
+	int64_t identities_removed;
+};
+
+/**
+ * Returns true if a rule puts its application in the block cache, that is
+ * an enabled outbound rule blocking or allowing all ports.
+ */
+bool ruleset_covers(struct firewall_rule const *rule);
+
+/**
+ * Starts a refresh. Every rule currently in the firewall is then passed to
+ * ruleset_visit, and the refresh is finished with ruleset_end.
+ */
+void ruleset_begin(void);
+
+/**
+ * Visits an enumerated rule. Rules are recognized by a fingerprint of their
+ * properties, so an unchanged rule costs a single lookup. A new rule
+ * covering a path no other rule covers reports it through added, in the
+ * form path_canonicalize converts it to, and so is the path_identify key of
+ * its file if it has one. Rules of the same file share the key. A rule
+ * whose short names or file identity did not resolve is converted again on
+ * every visit, a path it no longer covers then is reported through removed.
+ */
+void ruleset_visit(struct firewall_rule const *rule, ruleset_delta_t added, ruleset_delta_t removed);
+
+/**
+ * Finishes a refresh. If it was complete, rules not visited are dropped and
+ * paths no rule covers anymore are reported through removed. Rules missed by
+ * an incomplete refresh are kept until a complete one.
+ */
+void ruleset_end(bool complete, ruleset_delta_t removed);
+
+/**
+ * Forgets every rule, the next refresh reports each covered path as added.
+ */
+void ruleset_clear(void);
+
+/**
+ * Retrieves the ruleset counters.
+ */
+void ruleset_get_stats(struct ruleset_stats *stats);
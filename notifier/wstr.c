@@ -1,22 +1,442 @@
 #include "wstr.h"
 #include "config.h"
 #include "memory.h"
+#include "platform.h"
+#include <string.h>
 #include <wchar.h>
 
+#if defined(_M_X64) || defined(__x86_64__)
+#define WSTR_VECTOR 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef _MSC_VER
+#define WSTR_INLINE __forceinline
+#define WSTR_AVX2
+#else
+#define WSTR_INLINE inline __attribute__((always_inline))
+#define WSTR_AVX2 __attribute__((target("avx2")))
+#endif
+
+/**
+ * Case folding of characters outside ASCII: runs of characters sharing the
+ * delta to their folded form, every character of a run or every other one
+ * (stride 1 or 2), sorted.
+ *
+ * Generated from the simple case mappings of Unicode 14 for the basic
+ * multilingual plane. A character folds to the lowercase form of its
+ * uppercase form, or to its uppercase form if that one does not map back.
+ * Characters then fold alike exactly when they uppercase alike, which is
+ * how Windows compares paths (eg. U+017F folds to s, the Kelvin sign does
+ * not fold to k).
+ */
+static struct fold_run {
+	uint16_t first;
+	uint16_t last;
+	uint16_t stride;
+	int32_t delta;
+} const FOLD_RUNS[] = {
+	{0x00B5, 0x00B5, 1, 775}, {0x00C0, 0x00D6, 1, 32}, {0x00D8, 0x00DE, 1, 32},
+	{0x0100, 0x012E, 2, 1}, {0x0131, 0x0131, 1, -200}, {0x0132, 0x0136, 2, 1},
+	{0x0139, 0x0147, 2, 1}, {0x014A, 0x0176, 2, 1}, {0x0178, 0x0178, 1, -121},
+	{0x0179, 0x017D, 2, 1}, {0x017F, 0x017F, 1, -268}, {0x0181, 0x0181, 1, 210},
+	{0x0182, 0x0184, 2, 1}, {0x0186, 0x0186, 1, 206}, {0x0187, 0x0187, 1, 1},
+	{0x0189, 0x018A, 1, 205}, {0x018B, 0x018B, 1, 1}, {0x018E, 0x018E, 1, 79},
+	{0x018F, 0x018F, 1, 202}, {0x0190, 0x0190, 1, 203}, {0x0191, 0x0191, 1, 1},
+	{0x0193, 0x0193, 1, 205}, {0x0194, 0x0194, 1, 207}, {0x0196, 0x0196, 1, 211},
+	{0x0197, 0x0197, 1, 209}, {0x0198, 0x0198, 1, 1}, {0x019C, 0x019C, 1, 211},
+	{0x019D, 0x019D, 1, 213}, {0x019F, 0x019F, 1, 214}, {0x01A0, 0x01A4, 2, 1},
+	{0x01A6, 0x01A6, 1, 218}, {0x01A7, 0x01A7, 1, 1}, {0x01A9, 0x01A9, 1, 218},
+	{0x01AC, 0x01AC, 1, 1}, {0x01AE, 0x01AE, 1, 218}, {0x01AF, 0x01AF, 1, 1},
+	{0x01B1, 0x01B2, 1, 217}, {0x01B3, 0x01B5, 2, 1}, {0x01B7, 0x01B7, 1, 219},
+	{0x01B8, 0x01B8, 1, 1}, {0x01BC, 0x01BC, 1, 1}, {0x01C4, 0x01C4, 1, 2},
+	{0x01C5, 0x01C5, 1, 1}, {0x01C7, 0x01C7, 1, 2}, {0x01C8, 0x01C8, 1, 1},
+	{0x01CA, 0x01CA, 1, 2}, {0x01CB, 0x01DB, 2, 1}, {0x01DE, 0x01EE, 2, 1},
+	{0x01F1, 0x01F1, 1, 2}, {0x01F2, 0x01F4, 2, 1}, {0x01F6, 0x01F6, 1, -97},
+	{0x01F7, 0x01F7, 1, -56}, {0x01F8, 0x021E, 2, 1}, {0x0220, 0x0220, 1, -130},
+	{0x0222, 0x0232, 2, 1}, {0x023A, 0x023A, 1, 10795}, {0x023B, 0x023B, 1, 1},
+	{0x023D, 0x023D, 1, -163}, {0x023E, 0x023E, 1, 10792}, {0x0241, 0x0241, 1, 1},
+	{0x0243, 0x0243, 1, -195}, {0x0244, 0x0244, 1, 69}, {0x0245, 0x0245, 1, 71},
+	{0x0246, 0x024E, 2, 1}, {0x0345, 0x0345, 1, 116}, {0x0370, 0x0372, 2, 1},
+	{0x0376, 0x0376, 1, 1}, {0x037F, 0x037F, 1, 116}, {0x0386, 0x0386, 1, 38},
+	{0x0388, 0x038A, 1, 37}, {0x038C, 0x038C, 1, 64}, {0x038E, 0x038F, 1, 63},
+	{0x0391, 0x03A1, 1, 32}, {0x03A3, 0x03AB, 1, 32}, {0x03C2, 0x03C2, 1, 1},
+	{0x03CF, 0x03CF, 1, 8}, {0x03D0, 0x03D0, 1, -30}, {0x03D1, 0x03D1, 1, -25},
+	{0x03D5, 0x03D5, 1, -15}, {0x03D6, 0x03D6, 1, -22}, {0x03D8, 0x03EE, 2, 1},
+	{0x03F0, 0x03F0, 1, -54}, {0x03F1, 0x03F1, 1, -48}, {0x03F5, 0x03F5, 1, -64},
+	{0x03F7, 0x03F7, 1, 1}, {0x03F9, 0x03F9, 1, -7}, {0x03FA, 0x03FA, 1, 1},
+	{0x03FD, 0x03FF, 1, -130}, {0x0400, 0x040F, 1, 80}, {0x0410, 0x042F, 1, 32},
+	{0x0460, 0x0480, 2, 1}, {0x048A, 0x04BE, 2, 1}, {0x04C0, 0x04C0, 1, 15},
+	{0x04C1, 0x04CD, 2, 1}, {0x04D0, 0x052E, 2, 1}, {0x0531, 0x0556, 1, 48},
+	{0x10A0, 0x10C5, 1, 7264}, {0x10C7, 0x10C7, 1, 7264}, {0x10CD, 0x10CD, 1, 7264},
+	{0x13A0, 0x13EF, 1, 38864}, {0x13F0, 0x13F5, 1, 8}, {0x1C80, 0x1C80, 1, -6222},
+	{0x1C81, 0x1C81, 1, -6221}, {0x1C82, 0x1C82, 1, -6212}, {0x1C83, 0x1C84, 1, -6210},
+	{0x1C85, 0x1C85, 1, -6211}, {0x1C86, 0x1C86, 1, -6204}, {0x1C87, 0x1C87, 1, -6180},
+	{0x1C88, 0x1C88, 1, 35267}, {0x1C90, 0x1CBA, 1, -3008}, {0x1CBD, 0x1CBF, 1, -3008},
+	{0x1E00, 0x1E94, 2, 1}, {0x1E9B, 0x1E9B, 1, -58}, {0x1EA0, 0x1EFE, 2, 1},
+	{0x1F08, 0x1F0F, 1, -8}, {0x1F18, 0x1F1D, 1, -8}, {0x1F28, 0x1F2F, 1, -8},
+	{0x1F38, 0x1F3F, 1, -8}, {0x1F48, 0x1F4D, 1, -8}, {0x1F59, 0x1F5F, 2, -8},
+	{0x1F68, 0x1F6F, 1, -8}, {0x1FB8, 0x1FB9, 1, -8}, {0x1FBA, 0x1FBB, 1, -74},
+	{0x1FBE, 0x1FBE, 1, -7173}, {0x1FC8, 0x1FCB, 1, -86}, {0x1FD8, 0x1FD9, 1, -8},
+	{0x1FDA, 0x1FDB, 1, -100}, {0x1FE8, 0x1FE9, 1, -8}, {0x1FEA, 0x1FEB, 1, -112},
+	{0x1FEC, 0x1FEC, 1, -7}, {0x1FF8, 0x1FF9, 1, -128}, {0x1FFA, 0x1FFB, 1, -126},
+	{0x2132, 0x2132, 1, 28}, {0x2160, 0x216F, 1, 16}, {0x2183, 0x2183, 1, 1},
+	{0x24B6, 0x24CF, 1, 26}, {0x2C00, 0x2C2F, 1, 48}, {0x2C60, 0x2C60, 1, 1},
+	{0x2C62, 0x2C62, 1, -10743}, {0x2C63, 0x2C63, 1, -3814}, {0x2C64, 0x2C64, 1, -10727},
+	{0x2C67, 0x2C6B, 2, 1}, {0x2C6D, 0x2C6D, 1, -10780}, {0x2C6E, 0x2C6E, 1, -10749},
+	{0x2C6F, 0x2C6F, 1, -10783}, {0x2C70, 0x2C70, 1, -10782}, {0x2C72, 0x2C72, 1, 1},
+	{0x2C75, 0x2C75, 1, 1}, {0x2C7E, 0x2C7F, 1, -10815}, {0x2C80, 0x2CE2, 2, 1},
+	{0x2CEB, 0x2CED, 2, 1}, {0x2CF2, 0x2CF2, 1, 1}, {0xA640, 0xA66C, 2, 1},
+	{0xA680, 0xA69A, 2, 1}, {0xA722, 0xA72E, 2, 1}, {0xA732, 0xA76E, 2, 1},
+	{0xA779, 0xA77B, 2, 1}, {0xA77D, 0xA77D, 1, -35332}, {0xA77E, 0xA786, 2, 1},
+	{0xA78B, 0xA78B, 1, 1}, {0xA78D, 0xA78D, 1, -42280}, {0xA790, 0xA792, 2, 1},
+	{0xA796, 0xA7A8, 2, 1}, {0xA7AA, 0xA7AA, 1, -42308}, {0xA7AB, 0xA7AB, 1, -42319},
+	{0xA7AC, 0xA7AC, 1, -42315}, {0xA7AD, 0xA7AD, 1, -42305}, {0xA7AE, 0xA7AE, 1, -42308},
+	{0xA7B0, 0xA7B0, 1, -42258}, {0xA7B1, 0xA7B1, 1, -42282}, {0xA7B2, 0xA7B2, 1, -42261},
+	{0xA7B3, 0xA7B3, 1, 928}, {0xA7B4, 0xA7C2, 2, 1}, {0xA7C4, 0xA7C4, 1, -48},
+	{0xA7C5, 0xA7C5, 1, -42307}, {0xA7C6, 0xA7C6, 1, -35384}, {0xA7C7, 0xA7C9, 2, 1},
+	{0xA7D0, 0xA7D0, 1, 1}, {0xA7D6, 0xA7D8, 2, 1}, {0xA7F5, 0xA7F5, 1, 1},
+	{0xFF21, 0xFF3A, 1, 32},
+};
+
+#define FOLD_RUN_COUNT (sizeof(FOLD_RUNS) / sizeof(FOLD_RUNS[0]))
+
+static struct {
+	int64_t volatile fold;
+} g = {-1};
+
+/**
+ * Folds a character outside ASCII by the table.
+ */
+static wchar_t fold_table(wchar_t c) {
+	uint32_t u = (uint32_t)c;
+
+#if WCHAR_MAX > 0xFFFF
+	if (u > 0xFFFF) {
+		return c;
+	}
+#endif
+
+	size_t lo = 0;
+	size_t hi = FOLD_RUN_COUNT;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (u > FOLD_RUNS[mid].last) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo < FOLD_RUN_COUNT) {
+		struct fold_run const* r = &FOLD_RUNS[lo];
+		if (u >= r->first && (u - r->first) % r->stride == 0) {
+			return (wchar_t)((int32_t)u + r->delta);
+		}
+	}
+
+	return c;
+}
+
+/**
+ * Folds a character to lowercase, see FOLD_RUNS.
+ */
+static WSTR_INLINE wchar_t fold_char(wchar_t c) {
+	if ((uint32_t)c < 0x80) {
+		return c >= L'A' && c <= L'Z' ? (wchar_t)(c + 0x20) : c;
+	}
+
+	return fold_table(c);
+}
+
+#ifdef WSTR_VECTOR
+
+/**
+ * Lanewise operations on vectors of wchar_t, 16 or 32 bits wide.
+ */
+#if WCHAR_MAX > 0xFFFF
+#define V128_SET1(x) _mm_set1_epi32(x)
+#define V128_CMPGT _mm_cmpgt_epi32
+#define V128_ADD _mm_add_epi32
+#define V256_SET1(x) _mm256_set1_epi32(x)
+#define V256_CMPGT _mm256_cmpgt_epi32
+#define V256_ADD _mm256_add_epi32
+#else
+#define V128_SET1(x) _mm_set1_epi16((short)(x))
+#define V128_CMPGT _mm_cmpgt_epi16
+#define V128_ADD _mm_add_epi16
+#define V256_SET1(x) _mm256_set1_epi16((short)(x))
+#define V256_CMPGT _mm256_cmpgt_epi16
+#define V256_ADD _mm256_add_epi16
+#endif
+
+/**
+ * Folds a block of characters of the string, loaded at once. Returns false,
+ * storing nothing, if the block holds a character outside ASCII (compared
+ * signed, so 16-bit characters from 0x8000 are negative).
+ */
+static WSTR_INLINE bool fold_block_sse2(wchar_t* dest, wchar_t const* src) {
+	__m128i v = _mm_loadu_si128((__m128i const*)src);
+	__m128i ascii = _mm_and_si128(V128_CMPGT(v, _mm_setzero_si128()), V128_CMPGT(V128_SET1(0x80), v));
+
+	if (_mm_movemask_epi8(ascii) != 0xFFFF) {
+		return false;
+	}
+
+	__m128i upper = _mm_and_si128(V128_CMPGT(v, V128_SET1(L'A' - 1)), V128_CMPGT(V128_SET1(L'Z' + 1), v));
+	_mm_storeu_si128((__m128i*)dest, V128_ADD(v, _mm_and_si128(upper, V128_SET1(0x20))));
+
+	return true;
+}
+
+/**
+ * Same as fold_block_sse2, twice as wide.
+ */
+static WSTR_AVX2 WSTR_INLINE bool fold_block_avx2(wchar_t* dest, wchar_t const* src) {
+	__m256i v = _mm256_loadu_si256((__m256i const*)src);
+	__m256i ascii = _mm256_and_si256(V256_CMPGT(v, _mm256_setzero_si256()), V256_CMPGT(V256_SET1(0x80), v));
+
+	if (_mm256_movemask_epi8(ascii) != -1) {
+		return false;
+	}
+
+	__m256i upper = _mm256_and_si256(V256_CMPGT(v, V256_SET1(L'A' - 1)), V256_CMPGT(V256_SET1(L'Z' + 1), v));
+	_mm256_storeu_si256((__m256i*)dest, V256_ADD(v, _mm256_and_si256(upper, V256_SET1(0x20))));
+
+	return true;
+}
+
+#endif
+
+/**
+ * Copies a string in lowercase, see wstr_lower_copy. Characters are folded
+ * in blocks of the given number of lanes while the blocks are all ASCII and
+ * lie within the string, one at a time otherwise or without a block
+ * function.
+ */
+static WSTR_INLINE size_t fold_string(wchar_t* dest, size_t dest_count, wchar_t const* src, size_t lanes, bool (*block)(wchar_t*, wchar_t const*)) {
+	size_t len = wcsnlen(src, dest_count);
+	size_t i = 0;
+
+	while (i < len) {
+		if (block && len - i >= lanes && block(dest + i, src + i)) {
+			i += lanes;
+			continue;
+		}
+
+		dest[i] = fold_char(src[i]);
+		++i;
+	}
+
+	if (len == dest_count) {
+		dest[dest_count - 1] = 0;
+		return dest_count;
+	}
+
+	dest[len] = 0;
+	return len;
+}
+
+static size_t fold_scalar(wchar_t* dest, size_t dest_count, wchar_t const* src) {
+	return fold_string(dest, dest_count, src, 1, NULL);
+}
+
+#ifdef WSTR_VECTOR
+
+static size_t fold_sse2(wchar_t* dest, size_t dest_count, wchar_t const* src) {
+	return fold_string(dest, dest_count, src, sizeof(__m128i) / sizeof(*src), fold_block_sse2);
+}
+
+static WSTR_AVX2 size_t fold_avx2(wchar_t* dest, size_t dest_count, wchar_t const* src) {
+	return fold_string(dest, dest_count, src, sizeof(__m256i) / sizeof(*src), fold_block_avx2);
+}
+
+#endif
+
+/**
+ * Returns the fastest case folding the processor supports. Every x64
+ * processor has SSE2, AVX2 needs the operating system to save its state.
+ */
+static enum WSTR_FOLD fold_detect(void) {
+#if defined(WSTR_VECTOR) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+
+	if (info[0] >= 7) {
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+
+		__cpuidex(info, 7, 0);
+		if (osxsave && (info[1] & (1 << 5)) != 0 && (_xgetbv(0) & 6) == 6) {
+			return WSTR_FOLD_AVX2;
+		}
+	}
+
+	return WSTR_FOLD_SSE2;
+#elif defined(WSTR_VECTOR)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? WSTR_FOLD_AVX2 : WSTR_FOLD_SSE2;
+#else
+	return WSTR_FOLD_SCALAR;
+#endif
+}
+
+enum WSTR_FOLD wstr_fold_select(enum WSTR_FOLD fold) {
+	enum WSTR_FOLD best = fold_detect();
+	if (fold > best) {
+		fold = best;
+	}
+
+	int64_t current = platform_atomic_load(&g.fold);
+	while (platform_atomic_cas(&g.fold, current, fold) != current) {
+		current = platform_atomic_load(&g.fold);
+	}
+
+	return fold;
+}
+
+/**
+ * Copies a string in lowercase with the selected case folding.
+ */
+static size_t fold(wchar_t* dest, size_t dest_count, wchar_t const* src) {
+	int64_t selected = platform_atomic_load(&g.fold);
+	if (selected < 0) {
+		selected = wstr_fold_select(WSTR_FOLD_AVX2);
+	}
+
+#ifdef WSTR_VECTOR
+	if (selected == WSTR_FOLD_AVX2) {
+		return fold_avx2(dest, dest_count, src);
+	}
+
+	if (selected == WSTR_FOLD_SSE2) {
+		return fold_sse2(dest, dest_count, src);
+	}
+#endif
+
+	return fold_scalar(dest, dest_count, src);
+}
+
+/**
+ * Secrets and seed of the string hash, as in wyhash.
+ */
+#define HASH_SECRET0 0xa0761d6478bd642fULL
+#define HASH_SECRET1 0xe7037ed1a0b428dbULL
+#define HASH_SECRET2 0x8ebc6af09c88c6e3ULL
+#define HASH_SECRET3 0x589965cc75374cc3ULL
+#define HASH_SEED 0x5EED5EED5EED5EEDULL
+
+/**
+ * Multiplies two values into 128 bits, low half in a and high half in b.
+ */
+static WSTR_INLINE void hash_multiply(uint64_t* a, uint64_t* b) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	*a = _umul128(*a, *b, b);
+#elif defined(__SIZEOF_INT128__)
+	unsigned __int128 r = (unsigned __int128)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32;
+	uint64_t la = (uint32_t)*a;
+	uint64_t hb = *b >> 32;
+	uint64_t lb = (uint32_t)*b;
+	uint64_t hh = ha * hb;
+	uint64_t hl = ha * lb;
+	uint64_t lh = la * hb;
+	uint64_t ll = la * lb;
+	uint64_t t = ll + (hl << 32);
+	uint64_t carry = t < ll;
+	uint64_t lo = t + (lh << 32);
+	carry += lo < t;
+	*a = lo;
+	*b = hh + (hl >> 32) + (lh >> 32) + carry;
+#endif
+}
+
+/**
+ * Mixes two values, folding their 128-bit product.
+ */
+static WSTR_INLINE uint64_t hash_mix(uint64_t a, uint64_t b) {
+	hash_multiply(&a, &b);
+	return a ^ b;
+}
+
+static WSTR_INLINE uint64_t hash_read8(uint8_t const* p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static WSTR_INLINE uint64_t hash_read4(uint8_t const* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+size_t wstr_len(wchar_t const* str, size_t max_count) {
+	if (str == NULL) {
+		return 0;
+	}
+
+	/* The C runtimes scan several characters a step. */
+	return wcsnlen(str, max_count);
+}
+
+bool wstr_copy(wchar_t* dest, size_t dest_count, wchar_t const* src) {
+	if (dest == NULL || dest_count == 0) {
+		return false;
+	}
+
+	size_t len = wstr_len(src, dest_count);
+	if (src == NULL || len >= dest_count) {
+		dest[0] = 0;
+		return false;
+	}
+
+	memcpy(dest, src, sizeof(*dest) * (len + 1));
+
+	return true;
+}
+
+bool wstr_cat(wchar_t* dest, size_t dest_count, wchar_t const* src) {
+	if (dest == NULL || src == NULL) {
+		return false;
+	}
+
+	size_t len = wstr_len(dest, dest_count);
+	if (len >= dest_count) {
+		return false;
+	}
+
+	size_t src_len = wstr_len(src, dest_count - len);
+	if (len + src_len >= dest_count) {
+		return false;
+	}
+
+	memcpy(dest + len, src, sizeof(*dest) * (src_len + 1));
+
+	return true;
+}
+
 wchar_t* wstr_dup(wchar_t const* str) {
 	if (str == 0) {
 		return NULL;
 	}
 
-	size_t len = wcsnlen_s(str, MAX_EXT_PATH);
+	size_t len = wstr_len(str, MAX_EXT_PATH);
 	if (len >= MAX_EXT_PATH) {
 		return NULL;
 	}
 
 	size_t count = len + 1;
-	wchar_t* res = MEMORY_ALLOC_COUNT(res, count);
+	wchar_t* res = memory_alloc_raw(MEMORY_TAG_WSTR, sizeof(*res) * count);
 
-	if (wcscpy_s(res, count, str) != 0) {
+	if (res == NULL || wstr_copy(res, count, str) == false) {
 		memory_free(res);
 		return NULL;
 	}
@@ -24,18 +444,84 @@ wchar_t* wstr_dup(wchar_t const* str) {
 	return res;
 }
 
-uint64_t wstr_hash(wchar_t const *src) {
-	/* FNV1-a: http://www.isthe.com/chongo/tech/comp/fnv/ */
-	uint64_t hash = 14695981039346656037;
+uint64_t wstr_hash_len(wchar_t const *str, size_t len) {
+	/* After wyhash: https://github.com/wangyi-fudan/wyhash. Takes 48 bytes
+	 * a step in three independent lanes, each mixed by a 128-bit multiply,
+	 * instead of one multiply per character chained through the whole
+	 * string. Reads no byte outside the string. */
+	uint8_t const* p = (uint8_t const*)str;
+	size_t n = sizeof(*str) * len;
+	uint64_t seed = HASH_SEED ^ hash_mix(HASH_SEED ^ HASH_SECRET0, HASH_SECRET1);
+	uint64_t a = 0;
+	uint64_t b = 0;
+
+	if (n <= 16) {
+		if (n >= 4) {
+			size_t middle = (n >> 3) << 2;
+			a = (hash_read4(p) << 32) | hash_read4(p + middle);
+			b = (hash_read4(p + n - 4) << 32) | hash_read4(p + n - 4 - middle);
+		} else if (n > 0) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[n >> 1] << 8) | p[n - 1];
+		}
+	} else {
+		size_t i = n;
+
+		if (i > 48) {
+			uint64_t lane1 = seed;
+			uint64_t lane2 = seed;
+
+			do {
+				seed = hash_mix(hash_read8(p) ^ HASH_SECRET1, hash_read8(p + 8) ^ seed);
+				lane1 = hash_mix(hash_read8(p + 16) ^ HASH_SECRET2, hash_read8(p + 24) ^ lane1);
+				lane2 = hash_mix(hash_read8(p + 32) ^ HASH_SECRET3, hash_read8(p + 40) ^ lane2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+
+			seed ^= lane1 ^ lane2;
+		}
 
-	if (src) {
-		for (size_t i = 0; src[i]; ++i) {
-			hash ^= src[i];
-			hash *= 1099511628211;
+		while (i > 16) {
+			seed = hash_mix(hash_read8(p) ^ HASH_SECRET1, hash_read8(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
 		}
+
+		a = hash_read8(p + i - 16);
+		b = hash_read8(p + i - 8);
+	}
+
+	a ^= HASH_SECRET1;
+	b ^= seed;
+	hash_multiply(&a, &b);
+
+	return hash_mix(a ^ HASH_SECRET0 ^ n, b ^ HASH_SECRET1);
+}
+
+uint64_t wstr_hash(wchar_t const *str) {
+	return wstr_hash_len(str, wstr_len(str, SIZE_MAX));
+}
+
+size_t wstr_lower_copy(wchar_t *dest, size_t dest_count, wchar_t const *src) {
+	if (dest == NULL || dest_count == 0 || src == NULL) {
+		return dest_count;
 	}
 
-	return hash;
+	return fold(dest, dest_count, src);
+}
+
+size_t wstr_lower_hash(wchar_t *dest, size_t dest_count, wchar_t const *src, uint64_t *hash) {
+	if (hash == NULL) {
+		return dest_count;
+	}
+
+	/* Hashed right after folding, while the copy is still hot. */
+	size_t len = wstr_lower_copy(dest, dest_count, src);
+	if (len < dest_count) {
+		*hash = wstr_hash_len(dest, len);
+	}
+
+	return len;
 }
 
 void wstr_lower(wchar_t *dest) {
@@ -43,7 +529,5 @@ void wstr_lower(wchar_t *dest) {
 		return;
 	}
 
-	for (int i = 0; dest[i]; ++i) {
-		dest[i] = towlower(dest[i]);
-	}
+	fold(dest, SIZE_MAX, dest);
 }
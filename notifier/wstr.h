@@ -1,6 +1,26 @@
 #pragma once
 #include "types.h"
 
+/**
+ * Returns the length of the given string, not counting the null terminator.
+ * Returns max_count if no terminator is found within max_count characters,
+ * or 0 if the string is NULL.
+ */
+size_t wstr_len(wchar_t const* str, size_t max_count);
+
+/**
+ * Copies a string into a destination buffer holding dest_count characters.
+ * Returns false (leaving an empty destination) if the string does not fit.
+ */
+bool wstr_copy(wchar_t* dest, size_t dest_count, wchar_t const* src);
+
+/**
+ * Appends a string to the one in a destination buffer holding dest_count
+ * characters. Returns false (leaving the destination unchanged) if the
+ * result does not fit.
+ */
+bool wstr_cat(wchar_t* dest, size_t dest_count, wchar_t const* src);
+
 /**
  * Returns a dynamically allocated copy of the given string on success.
  * Returns NULL on failure.
@@ -13,6 +33,44 @@ wchar_t* wstr_dup(wchar_t const* str);
 uint64_t wstr_hash(wchar_t const *str);
 
 /**
- * Performs lowercase conversion on the given string.
+ * Returns the hash of a string of known length, equal to wstr_hash of the
+ * string. It need not be null terminated.
+ */
+uint64_t wstr_hash_len(wchar_t const *str, size_t len);
+
+/**
+ * Implementations of the case folding of the wstr_lower functions, from
+ * slowest to fastest. They all fold alike, the vector ones take runs
+ * of ASCII characters a block at a time.
+ */
+enum WSTR_FOLD {
+	WSTR_FOLD_SCALAR,
+	WSTR_FOLD_SSE2,
+	WSTR_FOLD_AVX2,
+};
+
+/**
+ * Selects the case folding implementation, by default the fastest one the
+ * processor supports. Asking for one it does not support selects the
+ * fastest one it does. Returns the selected implementation.
+ */
+enum WSTR_FOLD wstr_fold_select(enum WSTR_FOLD fold);
+
+/**
+ * Copies a string in lowercase. dest may be src. Returns the length
+ * copied, or dest_count if the string does not fit.
+ */
+size_t wstr_lower_copy(wchar_t *dest, size_t dest_count, wchar_t const *src);
+
+/**
+ * Copies a string in lowercase like wstr_lower_copy and stores the hash of
+ * the copy, equal to wstr_hash of it, if it fits.
+ */
+size_t wstr_lower_hash(wchar_t *dest, size_t dest_count, wchar_t const *src, uint64_t *hash);
+
+/**
+ * Performs lowercase conversion on the given string. Characters are folded
+ * the way Windows compares paths, regardless of the locale: two characters
+ * fold alike when they have the same uppercase form.
  */
 void wstr_lower(wchar_t *dest);